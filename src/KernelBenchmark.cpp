@@ -0,0 +1,639 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <gflags/gflags.h>
+#include <iostream>
+#include <limits>
+#include <opencv2/opencv.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Letterbox.hpp"
+#include "Timer.hpp"
+#include "pose_estimation/SimccDecoder.hpp"
+#include "tracking/BboxUtil.hpp"
+#include "tracking/FlowPropagator.hpp"
+#include "tracking/LinearSumAssignment.hpp"
+
+// Define and parser command line arguments
+DEFINE_int32(trials, 100, "Number of timed repetitions of each kernel");
+DEFINE_int32(seed, 0, "Seed of the random inputs");
+
+// 前処理の画素値の差の許容値 [/ 255]。Letterbox は浮動小数点で補間するため OpenCV と最大 1 程度ずれる
+static const float maxPreprocessDiff = 1.0f + 1e-3f;
+// SimCC のデコード結果の座標の差の許容値 [ピクセル]。逆アフィン変換を float で計算する分だけずれる
+static const float maxSimccDiff = 1e-2f;
+
+/// @brief OpenCV の関数を組み合わせた従来の Yolov8 の前処理
+static void preprocessReference(const cv::Mat &img, const int inputWidth, const int inputHeight, cv::Mat &normalized)
+{
+    const float ratio = std::min((float)inputWidth / (float)img.cols, (float)inputHeight / (float)img.rows);
+    int resizedHeight = int((float)img.rows * ratio);
+    int resizedWidth = int((float)img.cols * ratio);
+    if (resizedHeight % 2 != 0) resizedHeight -= 1;
+    if (resizedWidth % 2 != 0) resizedWidth -= 1;
+    const int padW = (inputWidth - resizedWidth) / 2;
+    const int padH = (inputHeight - resizedHeight) / 2;
+
+    cv::Mat resized;
+    cv::resize(img, resized, cv::Size(resizedWidth, resizedHeight), 0, 0, cv::INTER_LINEAR);
+    cv::copyMakeBorder(resized, resized, padH, padH, padW, padW, cv::BORDER_CONSTANT, cv::Scalar(128, 128, 128));
+    cv::cvtColor(resized, resized, cv::COLOR_BGR2RGB);
+    resized.convertTo(normalized, CV_32F);
+    normalized = normalized / 255.0f;
+}
+
+/// @brief 乱数画像で Letterbox を従来の前処理と比較し、最大誤差と処理時間を表示する
+/// @retval 誤差が許容値を超えたら false
+static bool benchmarkLetterbox(std::mt19937 &rng, const int imageWidth, const int imageHeight, const int inputWidth,
+                               const int inputHeight)
+{
+    cv::Mat img(imageHeight, imageWidth, CV_8UC3);
+    std::uniform_int_distribution<int> pixelValue(0, 255);
+    for (int y = 0; y < img.rows; y++)
+    {
+        unsigned char *row = img.ptr<unsigned char>(y);
+        for (int x = 0; x < img.cols * 3; x++)
+        {
+            row[x] = (unsigned char)pixelValue(rng);
+        }
+    }
+
+    Timer timerReference("Reference preprocess");
+    cv::Mat normalized;
+    for (int i = 0; i < FLAGS_trials; i++)
+    {
+        timerReference.Start();
+        preprocessReference(img, inputWidth, inputHeight, normalized);
+        timerReference.End();
+    }
+
+    Timer timerLetterbox("Letterbox preprocess");
+    Letterbox letterbox;
+    std::vector<float> buffer(inputWidth * inputHeight * 3);
+    for (int i = 0; i < FLAGS_trials; i++)
+    {
+        timerLetterbox.Start();
+        letterbox.Configure(img.cols, img.rows, inputWidth, inputHeight);
+        letterbox.Run(img, buffer.data());
+        timerLetterbox.End();
+    }
+
+    float maxDiff = 0.0f;
+    const float *reference = normalized.ptr<float>(0);
+    for (int i = 0; i < inputWidth * inputHeight * 3; i++)
+    {
+        maxDiff = std::max(maxDiff, std::fabs(reference[i] - buffer[i]));
+    }
+    std::cout << "Letterbox " << imageWidth << "x" << imageHeight << " -> " << inputWidth << "x" << inputHeight
+              << ": max diff from reference " << maxDiff * 255.0f << " / 255" << std::endl;
+    std::cout << "  Reference " << timerReference.ResultString() << std::endl;
+    std::cout << "  Letterbox " << timerLetterbox.ResultString() << std::endl;
+    return maxDiff * 255.0f <= maxPreprocessDiff;
+}
+
+/// @brief std::max_element と cv::Mat の逆アフィン変換による従来のデコード
+static void decodeSimccReference(const float *simcc_x_result, const float *simcc_y_result, const int joint_num,
+                                 const int extend_width, const int extend_height,
+                                 const cv::Mat &affineTransformReverse, const int imageWidth, const int imageHeight,
+                                 std::vector<PosePoint> &pose_result)
+{
+    pose_result.clear();
+    for (int i = 0; i < joint_num; i++)
+    {
+        auto x_biggest_iter =
+            std::max_element(simcc_x_result + i * extend_width, simcc_x_result + i * extend_width + extend_width);
+        int max_x_pos = std::distance(simcc_x_result + i * extend_width, x_biggest_iter);
+        auto y_biggest_iter =
+            std::max_element(simcc_y_result + i * extend_height, simcc_y_result + i * extend_height + extend_height);
+        int max_y_pos = std::distance(simcc_y_result + i * extend_height, y_biggest_iter);
+
+        cv::Mat origin_point_Mat = cv::Mat::ones(3, 1, CV_64FC1);
+        origin_point_Mat.at<double>(0, 0) = static_cast<float>(max_x_pos) / 2.0f;
+        origin_point_Mat.at<double>(1, 0) = static_cast<float>(max_y_pos) / 2.0f;
+        cv::Mat temp_result_mat = affineTransformReverse * origin_point_Mat;
+
+        PosePoint temp_point;
+        temp_point.x = temp_result_mat.at<double>(0, 0) / imageWidth;
+        temp_point.y = temp_result_mat.at<double>(1, 0) / imageHeight;
+        temp_point.score = std::max(*x_biggest_iter, *y_biggest_iter);
+        pose_result.emplace_back(temp_point);
+    }
+}
+
+/// @brief 乱数の SimCC 出力と逆アフィン変換で SimccDecoder を従来のデコードと比較し、最大誤差と処理時間を表示する
+/// @retval 座標の誤差が許容値を超えるか、スコアが一致しなければ false
+static bool benchmarkSimccDecoder(std::mt19937 &rng, const int numJoints, const int lengthX, const int lengthY)
+{
+    const int imageWidth = 1920;
+    const int imageHeight = 1080;
+    std::uniform_real_distribution<float> logit(-1.0f, 1.0f);
+    std::vector<float> simccX(numJoints * lengthX);
+    std::vector<float> simccY(numJoints * lengthY);
+    for (float &value : simccX)
+    {
+        value = logit(rng);
+    }
+    for (float &value : simccY)
+    {
+        value = logit(rng);
+    }
+
+    // 人物のクロップから元画像への変換 (拡大縮小と平行移動)
+    std::uniform_real_distribution<double> scale(0.5, 3.0);
+    std::uniform_real_distribution<double> offset(0.0, 1000.0);
+    cv::Mat affineTransformReverse = cv::Mat::zeros(2, 3, CV_64FC1);
+    affineTransformReverse.at<double>(0, 0) = scale(rng);
+    affineTransformReverse.at<double>(1, 1) = affineTransformReverse.at<double>(0, 0);
+    affineTransformReverse.at<double>(0, 2) = offset(rng);
+    affineTransformReverse.at<double>(1, 2) = offset(rng);
+    float inverseAffine[6];
+    for (int i = 0; i < 6; i++)
+    {
+        inverseAffine[i] = (float)affineTransformReverse.at<double>(i / 3, i % 3);
+    }
+
+    // 1回の処理が短いので、Letterbox の 10 倍繰り返す
+    const int numTrials = FLAGS_trials * 10;
+    Timer timerReference("Reference SimCC decode");
+    std::vector<PosePoint> reference;
+    for (int i = 0; i < numTrials; i++)
+    {
+        timerReference.Start();
+        decodeSimccReference(simccX.data(), simccY.data(), numJoints, lengthX, lengthY, affineTransformReverse,
+                             imageWidth, imageHeight, reference);
+        timerReference.End();
+    }
+
+    Timer timerDecoder("SimccDecoder");
+    SimccDecoder decoder;
+    std::vector<PosePoint> decoded;
+    for (int i = 0; i < numTrials; i++)
+    {
+        timerDecoder.Start();
+        decoder.Decode(simccX.data(), simccY.data(), numJoints, lengthX, lengthY, inverseAffine, imageWidth,
+                       imageHeight, decoded);
+        timerDecoder.End();
+    }
+
+    float maxDiff = 0.0f;
+    bool isScoreMatched = true;
+    for (int i = 0; i < numJoints; i++)
+    {
+        maxDiff = std::max(maxDiff, std::fabs(reference[i].x - decoded[i].x) * imageWidth);
+        maxDiff = std::max(maxDiff, std::fabs(reference[i].y - decoded[i].y) * imageHeight);
+        if (reference[i].score != decoded[i].score) isScoreMatched = false;
+    }
+    std::cout << "SimccDecoder " << numJoints << " joints, " << lengthX << "x" << lengthY << ": max diff from reference "
+              << maxDiff << " px" << (isScoreMatched ? "" : ", scores mismatched") << std::endl;
+    std::cout << "  Reference " << timerReference.ResultString() << std::endl;
+    std::cout << "  Decoder   " << timerDecoder.ResultString() << std::endl;
+    return maxDiff <= maxSimccDiff && isScoreMatched;
+}
+
+/// @brief 全ての割当を列挙して最小コストを求める (行数、列数が 8 程度までの小さな行列向け)
+static double solveAssignmentByBruteForce(const std::vector<double> &cost, const int nrows, const int ncols)
+{
+    // 少ない方の各要素を、多い方の順列の先頭から割り当てる
+    const int minDim = std::min(nrows, ncols);
+    const int maxDim = std::max(nrows, ncols);
+    std::vector<int> perm(maxDim);
+    for (int i = 0; i < maxDim; i++)
+    {
+        perm[i] = i;
+    }
+    double best = std::numeric_limits<double>::infinity();
+    do
+    {
+        double sum = 0.0;
+        for (int i = 0; i < minDim; i++)
+        {
+            sum += nrows <= ncols ? cost[i * ncols + perm[i]] : cost[perm[i] * ncols + i];
+        }
+        best = std::min(best, sum);
+    } while (std::next_permutation(perm.begin(), perm.end()));
+    return best;
+}
+
+/// @brief 乱数のコスト行列で LinearSumAssignment の割当を全列挙の最小コストと比較する
+/// @param numLevels コストの値の種類。少ないほど同じコストの割当が多く、曖昧になる。0 なら連続値
+/// @retval 割当が不正か、コストが最小でなければ false
+static bool checkLinearSumAssignment(std::mt19937 &rng, const int nrows, const int ncols, const int numLevels)
+{
+    LinearSumAssignment lsa;
+    std::vector<double> cost(nrows * ncols);
+    std::vector<RowCol> association;
+    std::vector<unsigned char> isColUsed(ncols);
+    std::uniform_int_distribution<int> level(0, std::max(numLevels - 1, 0));
+    std::uniform_real_distribution<double> continuous(-1.0, 0.0);
+    int numMismatched = 0;
+    for (int trial = 0; trial < FLAGS_trials; trial++)
+    {
+        // Byte の割当と同じく、IoU に相当する [-1, 0] のコスト
+        for (double &c : cost)
+        {
+            c = numLevels > 0 ? -(double)level(rng) / numLevels : continuous(rng);
+        }
+        bool isValid = lsa.Solve(cost.data(), nrows, ncols, association);
+        isValid = isValid && (int)association.size() == std::min(nrows, ncols);
+        std::fill(isColUsed.begin(), isColUsed.end(), 0);
+        double solved = 0.0;
+        for (size_t i = 0; isValid && i < association.size(); i++)
+        {
+            const RowCol &rc = association[i];
+            isValid = rc.row >= 0 && rc.row < nrows && rc.col >= 0 && rc.col < ncols && isColUsed[rc.col] == 0;
+            isValid = isValid && (i == 0 || association[i - 1].row < rc.row);
+            if (!isValid) break;
+            isColUsed[rc.col] = 1;
+            solved += cost[rc.row * ncols + rc.col];
+        }
+        const double best = solveAssignmentByBruteForce(cost, nrows, ncols);
+        if (!isValid || std::fabs(solved - best) > 1e-9) numMismatched++;
+    }
+    const std::string costType = numLevels > 0 ? std::to_string(numLevels) + " levels" : "continuous";
+    std::cout << "LinearSumAssignment " << nrows << "x" << ncols << " (" << costType << "): " << numMismatched << " / "
+              << FLAGS_trials << " mismatched" << std::endl;
+    return numMismatched == 0;
+}
+
+/// @brief 混雑したシーンの大きさのコスト行列で LinearSumAssignment の処理時間を表示する
+static void benchmarkLinearSumAssignment(std::mt19937 &rng, const int nrows, const int ncols)
+{
+    LinearSumAssignment lsa;
+    std::vector<double> cost(nrows * ncols);
+    std::vector<RowCol> association;
+    std::uniform_real_distribution<double> continuous(-1.0, 0.0);
+    Timer timer("LinearSumAssignment");
+    for (int trial = 0; trial < FLAGS_trials; trial++)
+    {
+        for (double &c : cost)
+        {
+            c = continuous(rng);
+        }
+        timer.Start();
+        lsa.Solve(cost.data(), nrows, ncols, association);
+        timer.End();
+    }
+    std::cout << "LinearSumAssignment " << nrows << "x" << ncols << " " << timer.ResultString() << std::endl;
+}
+
+/// @brief IoU の検査用の乱数のボックス。通常のボックスのほか、幅が 0、高さが負、座標が nan、座標が -0 のものを混ぜる
+template <typename T>
+static void makeTestBox(std::mt19937 &rng, T &x0, T &y0, T &x1, T &y1)
+{
+    std::uniform_real_distribution<double> coord(0.0, 1.0);
+    std::uniform_real_distribution<double> size(0.0, 0.3);
+    std::uniform_int_distribution<int> kind(0, 9);
+    x0 = (T)coord(rng);
+    y0 = (T)coord(rng);
+    x1 = (T)(x0 + size(rng));
+    y1 = (T)(y0 + size(rng));
+    switch (kind(rng))
+    {
+    case 0:
+        x1 = x0;
+        break;
+    case 1:
+        std::swap(y0, y1);
+        break;
+    case 2:
+        x0 = std::numeric_limits<T>::quiet_NaN();
+        break;
+    case 3:
+        y1 = std::numeric_limits<T>::quiet_NaN();
+        break;
+    case 4:
+        x0 = (T)-0.0;
+        y0 = (T)-0.0;
+        break;
+    default:
+        break;
+    }
+}
+
+/// @brief 2つの double がビット単位で一致するかどうか (nan どうしや 0 と -0 も区別する)
+static bool isBitwiseEqual(const double a, const double b)
+{
+    uint64_t bitsA;
+    uint64_t bitsB;
+    std::memcpy(&bitsA, &a, sizeof(a));
+    std::memcpy(&bitsB, &b, sizeof(b));
+    return bitsA == bitsB;
+}
+
+/// @brief 従来の NMS の抑制判定。box が後から来た候補、boxes の j 番目が残した候補
+static bool isSuppressedReference(const float x0, const float y0, const float x1, const float y1, const float area,
+                                  const BboxArray<float> &boxes, const int j, const float iouThreshold)
+{
+    const float w = std::min(x1, boxes.x1s[j]) - std::max(x0, boxes.x0s[j]);
+    const float h = std::min(y1, boxes.y1s[j]) - std::max(y0, boxes.y0s[j]);
+    if (w <= 0.0f || h <= 0.0f) return 0.0f > iouThreshold;
+    const float inter = w * h;
+    const float unionArea = area + boxes.areas[j] - inter;
+    if (unionArea <= 0.0f) return 0.0f > iouThreshold;
+    return inter > iouThreshold * unionArea;
+}
+
+/// @brief 乱数のボックスで BboxUtil の一括 IoU 計算を CalcIou と要素ごとに比較し、FindIouAbove を従来の NMS の
+/// 抑制判定と比較する。長さを 1 ずつ変えて、AVX2 (4 / 8 要素)、SSE2 (2 / 4 要素)、スカラーの端数の全ての経路を通す
+/// @retval CalcIous か CalcIouMatrix が CalcIou とビット単位で一致しないか、FindIouAbove の結果が異なれば false
+static bool checkBboxUtil(std::mt19937 &rng, const int maxLength)
+{
+    int numIousMismatched = 0;
+    int numMatrixMismatched = 0;
+    int numFindMismatched = 0;
+    int numChecks = 0;
+    std::vector<BboxXyxy> rows;
+    std::vector<BboxXyxy> cols;
+    BboxArray<double> rowArray;
+    BboxArray<double> colArray;
+    BboxArray<float> floatBoxes;
+    std::vector<double> ious;
+    std::uniform_int_distribution<int> numRows(0, 5);
+    const float iouThresholds[] = {0.0f, 0.3f, 0.5f, 0.9f, -0.1f};
+    for (int trial = 0; trial < FLAGS_trials; trial++)
+    {
+        for (int length = 0; length <= maxLength; length++)
+        {
+            numChecks++;
+            cols.resize(length);
+            for (BboxXyxy &b : cols)
+            {
+                makeTestBox(rng, b.x0, b.y0, b.x1, b.y1);
+            }
+            rows.resize(numRows(rng));
+            for (BboxXyxy &b : rows)
+            {
+                makeTestBox(rng, b.x0, b.y0, b.x1, b.y1);
+            }
+            BboxUtil::ToArray(rows, rowArray);
+            BboxUtil::ToArray(cols, colArray);
+
+            // 1つと複数
+            bool isMatched = true;
+            ious.assign(length, 0.0);
+            const BboxXyxy &box = rows.empty() ? cols.empty() ? BboxXyxy() : cols[0] : rows[0];
+            BboxUtil::CalcIous(box, colArray, ious.data());
+            for (int j = 0; j < length; j++)
+            {
+                isMatched = isMatched && isBitwiseEqual(ious[j], BboxUtil::CalcIou(cols[j], box));
+            }
+            if (!isMatched) numIousMismatched++;
+
+            // 複数と複数
+            isMatched = true;
+            ious.assign(rows.size() * length, 0.0);
+            BboxUtil::CalcIouMatrix(rowArray, colArray, ious.data());
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                for (int j = 0; j < length; j++)
+                {
+                    isMatched = isMatched && isBitwiseEqual(ious[i * length + j], BboxUtil::CalcIou(cols[j], rows[i]));
+                }
+            }
+            if (!isMatched) numMatrixMismatched++;
+
+            // NMS の抑制判定。重なるボックスが後ろの方にも来るよう、候補と同じボックスを1つ混ぜる
+            float x0, y0, x1, y1;
+            makeTestBox(rng, x0, y0, x1, y1);
+            const float area = (x1 - x0) * (y1 - y0);
+            floatBoxes.Clear();
+            for (int j = 0; j < length; j++)
+            {
+                floatBoxes.PushBack((float)cols[j].x0, (float)cols[j].y0, (float)cols[j].x1, (float)cols[j].y1);
+            }
+            if (length > 0)
+            {
+                const int same = std::uniform_int_distribution<int>(0, length - 1)(rng);
+                floatBoxes.x0s[same] = x0;
+                floatBoxes.y0s[same] = y0;
+                floatBoxes.x1s[same] = x1;
+                floatBoxes.y1s[same] = y1;
+                floatBoxes.areas[same] = area;
+            }
+            for (const float iouThreshold : iouThresholds)
+            {
+                int expected = -1;
+                for (int j = 0; j < length && expected < 0; j++)
+                {
+                    if (isSuppressedReference(x0, y0, x1, y1, area, floatBoxes, j, iouThreshold)) expected = j;
+                }
+                const int found = BboxUtil::FindIouAbove(x0, y0, x1, y1, area, floatBoxes, iouThreshold);
+                if (found != expected)
+                {
+                    numFindMismatched++;
+                    break;
+                }
+            }
+        }
+    }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    const std::string simdPath = __builtin_cpu_supports("avx2") ? "AVX2 + SSE2" : "SSE2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const std::string simdPath = "NEON";
+#else
+    const std::string simdPath = "scalar";
+#endif
+    std::cout << "BboxUtil (" << simdPath << ", lengths 0-" << maxLength << "): CalcIous " << numIousMismatched
+              << ", CalcIouMatrix " << numMatrixMismatched << ", FindIouAbove " << numFindMismatched << " / "
+              << numChecks << " mismatched" << std::endl;
+    return numIousMismatched == 0 && numMatrixMismatched == 0 && numFindMismatched == 0;
+}
+
+/// @brief 8 ピクセル四方の乱数のブロックをぼかした RGB のテクスチャ画像を作る
+static void makeTexture(std::mt19937 &rng, const int width, const int height, cv::Mat &texture)
+{
+    cv::Mat blocks(height / 8 + 1, width / 8 + 1, CV_8UC1);
+    std::uniform_int_distribution<int> pixelValue(0, 255);
+    for (int y = 0; y < blocks.rows; y++)
+    {
+        unsigned char *row = blocks.ptr<unsigned char>(y);
+        for (int x = 0; x < blocks.cols; x++)
+        {
+            row[x] = (unsigned char)pixelValue(rng);
+        }
+    }
+    cv::Mat gray;
+    cv::resize(blocks, gray, cv::Size(width, height), 0, 0, cv::INTER_NEAREST);
+    cv::GaussianBlur(gray, gray, cv::Size(5, 5), 1.5);
+    cv::cvtColor(gray, texture, cv::COLOR_GRAY2RGB);
+}
+
+/// @brief 合成した映像で、物体検出を行わないフレームの FlowPropagator のボックスの誤差を
+/// 等速度の予測だけの場合と比べ、平均誤差と処理時間を表示する。
+/// 静止した背景の上を楕円形の人物が速度を変えながら動き、重なり合う。
+/// 検出フレームのボックスは真値とし、等速度の予測には直前の2回の検出フレームのボックスの差を使う
+/// @retval フローで動かしたボックスの中心の平均誤差が、予測だけの場合より大きければ false
+static bool benchmarkFlowPropagator(std::mt19937 &rng, const int numPeople, const int detectionInterval)
+{
+    const int imageWidth = 1280;
+    const int imageHeight = 720;
+    const int personWidth = 80;
+    const int personHeight = 200;
+    const int numFrames = 300;
+    const double maxSpeed = 8.0; // [pixel / frame]
+
+    cv::Mat background;
+    makeTexture(rng, imageWidth, imageHeight, background);
+    cv::Mat mask(personHeight, personWidth, CV_8UC1, cv::Scalar(0));
+    cv::ellipse(mask, cv::Point(personWidth / 2, personHeight / 2),
+                cv::Size(personWidth / 2 - 4, personHeight / 2 - 2), 0.0, 0.0, 360.0, cv::Scalar(255), cv::FILLED);
+    std::vector<cv::Mat> appearances(numPeople);
+    std::vector<cv::Vec2d> positions(numPeople);
+    std::vector<cv::Vec2d> velocities(numPeople);
+    const double maxX = imageWidth - personWidth - 1;
+    const double maxY = imageHeight - personHeight - 1;
+    std::uniform_real_distribution<double> initialX(0.0, maxX);
+    std::uniform_real_distribution<double> initialY(0.0, maxY);
+    std::uniform_real_distribution<double> initialSpeed(-6.0, 6.0);
+    std::normal_distribution<double> acceleration(0.0, 0.5);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int i = 0; i < numPeople; i++)
+    {
+        makeTexture(rng, personWidth, personHeight, appearances[i]);
+        positions[i] = cv::Vec2d(initialX(rng), initialY(rng));
+        velocities[i] = cv::Vec2d(initialSpeed(rng), initialSpeed(rng));
+    }
+
+    FlowPropagator propagator;
+    Timer timer("FlowPropagator");
+    cv::Mat image;
+    std::vector<BboxXyxy> truths(numPeople);
+    std::vector<BboxXyxy> lastDetections;
+    std::vector<BboxXyxy> prevDetections;
+    std::vector<TrackedBbox> tracks;
+    double sumPredictError = 0.0;
+    double sumFlowError = 0.0;
+    int numErrors = 0;
+    for (int frame = 0; frame < numFrames; frame++)
+    {
+        // 描画して真値のボックスを求める
+        background.copyTo(image);
+        for (int i = 0; i < numPeople; i++)
+        {
+            const int x = (int)std::round(positions[i][0]);
+            const int y = (int)std::round(positions[i][1]);
+            appearances[i].copyTo(image(cv::Rect(x, y, personWidth, personHeight)), mask);
+            truths[i] = BboxXyxy((double)x / imageWidth, (double)y / imageHeight,
+                                 (double)(x + personWidth) / imageWidth, (double)(y + personHeight) / imageHeight);
+        }
+
+        const int numFramesSinceDetection = frame % detectionInterval;
+        if (numFramesSinceDetection == 0)
+        {
+            prevDetections = frame == 0 ? truths : lastDetections;
+            lastDetections = truths;
+            tracks.clear();
+            for (int i = 0; i < numPeople; i++)
+            {
+                tracks.emplace_back(i, truths[i]);
+            }
+            propagator.SetReference(image, tracks);
+        }
+        else
+        {
+            // 等速度で予測したボックスをフローで動かす
+            const double ratio = (double)numFramesSinceDetection / detectionInterval;
+            for (int i = 0; i < numPeople; i++)
+            {
+                const BboxXyxy &last = lastDetections[i];
+                const BboxXyxy &prev = prevDetections[i];
+                tracks[i].bodyBbox = BboxXyxy(last.x0 + (last.x0 - prev.x0) * ratio, last.y0 + (last.y0 - prev.y0) * ratio,
+                                              last.x1 + (last.x1 - prev.x1) * ratio, last.y1 + (last.y1 - prev.y1) * ratio);
+            }
+            std::vector<BboxXyxy> predicted(numPeople);
+            for (int i = 0; i < numPeople; i++)
+            {
+                predicted[i] = tracks[i].bodyBbox;
+            }
+            timer.Start();
+            propagator.Propagate(image, tracks);
+            timer.End();
+
+            for (int i = 0; i < numPeople; i++)
+            {
+                const BboxXyxy &truth = truths[i];
+                sumPredictError += std::hypot((predicted[i].x_center() - truth.x_center()) * imageWidth,
+                                              (predicted[i].y_center() - truth.y_center()) * imageHeight);
+                sumFlowError += std::hypot((tracks[i].bodyBbox.x_center() - truth.x_center()) * imageWidth,
+                                           (tracks[i].bodyBbox.y_center() - truth.y_center()) * imageHeight);
+                numErrors++;
+            }
+        }
+
+        // 速度を少しずつ変え、まれに向きを変える。画像の端では跳ね返る
+        for (int i = 0; i < numPeople; i++)
+        {
+            cv::Vec2d &velocity = velocities[i];
+            const bool isTurning = uniform(rng) < 0.02;
+            for (int k = 0; k < 2; k++)
+            {
+                velocity[k] = isTurning ? initialSpeed(rng) : velocity[k] + acceleration(rng);
+                velocity[k] = std::max(std::min(velocity[k], maxSpeed), -maxSpeed);
+                const double limit = k == 0 ? maxX : maxY;
+                positions[i][k] += velocity[k];
+                if (positions[i][k] < 0.0 || positions[i][k] > limit)
+                {
+                    velocity[k] = -velocity[k];
+                    positions[i][k] = std::max(std::min(positions[i][k], limit), 0.0);
+                }
+            }
+        }
+    }
+
+    const double predictError = sumPredictError / std::max(numErrors, 1);
+    const double flowError = sumFlowError / std::max(numErrors, 1);
+    std::cout << "FlowPropagator " << numPeople << " people, detection interval " << detectionInterval
+              << ": mean center error " << flowError << " px (prediction only " << predictError << " px)" << std::endl;
+    std::cout << "  " << timer.ResultString() << std::endl;
+    return flowError <= predictError;
+}
+
+int main(int argc, char **argv)
+{
+    gflags::SetUsageMessage("Checks optimized kernels against reference implementations on random inputs.");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    std::mt19937 rng(FLAGS_seed);
+
+    bool isPassed = true;
+
+    // 横長、縦長、入力より小さい画像と、正方・長方形の入力サイズ
+    isPassed &= benchmarkLetterbox(rng, 1920, 1080, 640, 640);
+    isPassed &= benchmarkLetterbox(rng, 1280, 720, 640, 384);
+    isPassed &= benchmarkLetterbox(rng, 720, 1280, 640, 640);
+    isPassed &= benchmarkLetterbox(rng, 320, 240, 640, 640);
+
+    // RTMPose の出力サイズ (入力 192x256 の 2 倍)
+    isPassed &= benchmarkSimccDecoder(rng, 17, 384, 512);
+
+    // 正方、横長、縦長の行列。値の種類が少ない行列で同じコストの割当があっても最小になることを確かめる
+    const int assignmentSizes[][2] = {{1, 1}, {3, 5}, {5, 3}, {6, 6}, {4, 8}, {8, 4}, {7, 7}};
+    for (const auto &size : assignmentSizes)
+    {
+        isPassed &= checkLinearSumAssignment(rng, size[0], size[1], 3);
+        isPassed &= checkLinearSumAssignment(rng, size[0], size[1], 0);
+    }
+    benchmarkLinearSumAssignment(rng, 100, 120);
+
+    // nan や幅・高さが 0 以下のボックスを含めて、一括 IoU 計算が CalcIou と一致することを確かめる
+    isPassed &= checkBboxUtil(rng, 20);
+
+    // 重なりの少ないシーンと多いシーン
+    isPassed &= benchmarkFlowPropagator(rng, 8, 3);
+    isPassed &= benchmarkFlowPropagator(rng, 20, 3);
+
+    std::cout << (isPassed ? "All checks passed" : "Some checks failed") << std::endl;
+    return isPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
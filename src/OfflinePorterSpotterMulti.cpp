@@ -0,0 +1,285 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <gflags/gflags.h>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "ResourcePool.hpp"
+#include "Types.hpp"
+#include "VisualizationUtil.hpp"
+#include "pipeline/MultiStreamRunner.hpp"
+#include "pipeline/PorterSpotter.hpp"
+
+// Define and parser command line arguments
+DEFINE_string(d, "./models/yolov8s.dlc", "Path to detection model DLC file");
+DEFINE_string(p, "./models/rtmpose.dlc", "Path to pose estimation model DLC file");
+DEFINE_int32(det_width, 0, "Input width of detection network (multiple of 32, with -det_height). 0: use DLC input size");
+DEFINE_int32(det_height, 0, "Input height of detection network (multiple of 32, with -det_width). 0: use DLC input size");
+DEFINE_string(input_files, "videos/.sample.mp4", "Comma separated paths to input video files. e.g. a.mp4,b.mp4");
+DEFINE_string(output_dir, "outputs", "Path to output dir");
+DEFINE_bool(output_video, false, "Save track as annotated video");
+DEFINE_bool(person_box, false, "Draw person bbox in video");
+DEFINE_bool(skeleton, false, "Draw skeleton in video");
+DEFINE_int32(num_workers, 0, "Number of worker threads. 0: number of cores");
+DEFINE_int32(num_detectors, 0, "Number of detection network instances shared by all streams. 0: number of busy workers");
+DEFINE_int32(num_pose_estimators, 0,
+             "Number of pose estimation network instances shared by all streams. 0: number of busy workers");
+DEFINE_bool(gated_association, false, "Use spatially gated sparse association in tracking (for crowded scenes)");
+DEFINE_int32(detection_interval, 1, "Run object detection every N processed frames and track by prediction in between");
+DEFINE_int32(track_max_age, 5, "Drop a track not detected for this many nominal frame intervals (0.2 s)");
+DEFINE_double(uncertainty_limit, 0, "Run object detection when track position variance exceeds this. 0: disabled");
+DEFINE_bool(flow_propagation, false, "Move person boxes by sparse optical flow on frames without detection");
+DEFINE_bool(motion_gate, false, "Skip the pipeline on frames without motion when no person is tracked");
+DEFINE_double(activity_threshold, 0.002, "Fraction of changed pixels regarded as motion (with -motion_gate)");
+DEFINE_bool(pose_cache, false, "Reuse the previous pose of stationary tracks instead of running pose estimation");
+DEFINE_bool(proximity_gated_pose, false, "Run pose estimation only for persons near a detected object");
+DEFINE_double(frame_time_budget_ms, 0, "Time budget per frame [ms]. Pose estimation beyond it is deferred. 0: none");
+
+std::string getStem(const std::string &filePath)
+{
+    // strip path of directory and extension
+    // ex) "dir1/dir2/stem.ext" -> "stem"
+
+    // strip extension
+    size_t pos = filePath.rfind('.');
+    const std::string baseName = filePath.substr(0, pos);
+
+    // strip dir name
+    pos = baseName.rfind('/');
+    if (pos == std::string::npos)
+    {
+        return baseName;
+    }
+    else
+    {
+        return baseName.substr(pos + 1);
+    }
+}
+
+std::vector<std::string> splitPaths(const std::string &paths)
+{
+    std::vector<std::string> result;
+    std::stringstream ss(paths);
+    std::string path;
+    while (std::getline(ss, path, ','))
+    {
+        if (!path.empty()) result.push_back(path);
+    }
+    return result;
+}
+
+bool readDlc(const std::string &dlcPath, std::vector<char> &dlcBuff)
+{
+    // Get model file size using stat
+    struct stat sb;
+    if (stat(dlcPath.c_str(), &sb))
+    {
+        std::cout << "DLC file doesn't exist: " << dlcPath << std::endl;
+        return false;
+    }
+
+    // Read whole file
+    dlcBuff.resize(sb.st_size);
+    std::ifstream fin(dlcPath, std::ios::in | std::ios::binary);
+    if (!fin)
+    {
+        std::cout << "Couldn't open the DLC file" << dlcPath << std::endl;
+        return false;
+    }
+    fin.read(dlcBuff.data(), sb.st_size);
+    return true;
+}
+
+/// @brief 全ての映像で共有するネットワークを作る
+bool createModelPools(const std::vector<std::string> &runtimes, const int numDetectors, const int numPoseEstimators,
+                      ResourcePool<Yolov8> &detectorPool, ResourcePool<PoseEstimator> &poseEstimatorPool)
+{
+    std::vector<char> dlcBuff;
+    if (!readDlc(FLAGS_d, dlcBuff)) return false;
+    for (int i = 0; i < numDetectors; i++)
+    {
+        std::unique_ptr<Yolov8> detector(new Yolov8());
+        if (!detector->SetInputSize(FLAGS_det_width, FLAGS_det_height))
+        {
+            std::cout << "Invalid detection input size" << std::endl;
+            return false;
+        }
+        if (!detector->CreateNetwork((const uint8_t *)dlcBuff.data(), dlcBuff.size(), runtimes))
+        {
+            std::cout << "Couldn't create detecter." << std::endl;
+            return false;
+        }
+        detectorPool.Add(std::move(detector));
+    }
+
+    if (!readDlc(FLAGS_p, dlcBuff)) return false;
+    for (int i = 0; i < numPoseEstimators; i++)
+    {
+        std::unique_ptr<PoseEstimator> poseEstimator(new PoseEstimator());
+        if (!poseEstimator->CreateNetwork((const uint8_t *)dlcBuff.data(), dlcBuff.size(), runtimes))
+        {
+            std::cout << "Couldn't create pose estimator." << std::endl;
+            return false;
+        }
+        poseEstimatorPool.Add(std::move(poseEstimator));
+    }
+    return true;
+}
+
+/// @brief 映像ごとの入出力
+struct StreamIo
+{
+    cv::VideoCapture videoCapture;
+    cv::VideoWriter videoWriter;
+    double readIntervalSec;
+    double execIntervalSec;
+    int frameCnt;
+    double secondPassed;
+    double timestamp; // 読み込んだフレームの動画内の時刻
+};
+
+bool openStream(const std::string &filePath, const std::string &outDir, const bool isSaveVideo, StreamIo &io)
+{
+    io.videoCapture.open(filePath);
+    if (!io.videoCapture.isOpened())
+    {
+        std::cout << "Couldn't read video: " << filePath << std::endl;
+        return false;
+    }
+    std::cout << "Read video: " << filePath << std::endl;
+
+    const double readFps = io.videoCapture.get(cv::CAP_PROP_FPS);
+    const double execFps = 5;
+    if (isSaveVideo)
+    {
+        const std::string outputVideoFile = outDir + "/" + "output_" + getStem(filePath) + ".mp4";
+        const int fourcc = cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+        const int width = (int)io.videoCapture.get(cv::CAP_PROP_FRAME_WIDTH);
+        const int height = (int)io.videoCapture.get(cv::CAP_PROP_FRAME_HEIGHT);
+        io.videoWriter.open(outputVideoFile, fourcc, execFps, cv::Size(width, height));
+    }
+    io.readIntervalSec = 1 / readFps;
+    io.execIntervalSec = 1 / execFps;
+    io.frameCnt = 0;
+    io.secondPassed = 0;
+    io.timestamp = 0;
+    return true;
+}
+
+/// @brief execFps で処理するフレームまで読み進める
+bool readFrame(StreamIo &io, cv::Mat &image, double &timestamp)
+{
+    while (1)
+    {
+        io.videoCapture >> image;
+        if (image.empty() == true) return false;
+        const bool isExecFrame = io.frameCnt == 0 || io.secondPassed >= io.execIntervalSec;
+        timestamp = io.timestamp;
+        io.secondPassed += io.readIntervalSec;
+        io.timestamp += io.readIntervalSec;
+        if (isExecFrame)
+        {
+            io.secondPassed -= io.execIntervalSec;
+            io.frameCnt++;
+            return true;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    gflags::SetUsageMessage("Offline analysis program for multiple videos sharing networks.");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    const std::vector<std::string> filePaths = splitPaths(FLAGS_input_files);
+    if (filePaths.empty())
+    {
+        std::cout << "No input file" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // 同時にフレームを処理するワーカーの数だけネットワークがあれば、ネットワークを待たずに済む
+    MultiStreamRunner runner(FLAGS_num_workers);
+    const int numBusyWorkers = std::min(runner.GetNumWorkers(), (int)filePaths.size());
+    const int numDetectors = FLAGS_num_detectors > 0 ? FLAGS_num_detectors : numBusyWorkers;
+    const int numPoseEstimators = FLAGS_num_pose_estimators > 0 ? FLAGS_num_pose_estimators : numBusyWorkers;
+    if (numDetectors < numBusyWorkers || numPoseEstimators < numBusyWorkers)
+    {
+        std::cout << "Warning: " << numBusyWorkers << " workers share " << numDetectors << " detectors and "
+                  << numPoseEstimators << " pose estimators. Workers will wait for a free network." << std::endl;
+    }
+
+    const std::vector<std::string> runtimes = {"cpu"};
+    ResourcePool<Yolov8> detectorPool;
+    ResourcePool<PoseEstimator> poseEstimatorPool;
+    if (!createModelPools(runtimes, numDetectors, numPoseEstimators, detectorPool, poseEstimatorPool))
+    {
+        std::cout << "Failed to initialize models" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::unique_ptr<StreamIo>> streamIos;
+    for (const std::string &filePath : filePaths)
+    {
+        std::unique_ptr<StreamIo> io(new StreamIo());
+        if (!openStream(filePath, FLAGS_output_dir, FLAGS_output_video, *io)) return EXIT_FAILURE;
+
+        std::unique_ptr<PorterSpotter> porterSpotter(new PorterSpotter());
+        porterSpotter->SetModelPools(&detectorPool, &poseEstimatorPool);
+        porterSpotter->SetGatedAssociation(FLAGS_gated_association);
+        porterSpotter->SetDetectionInterval(FLAGS_detection_interval);
+        porterSpotter->SetUncertaintyLimit(FLAGS_uncertainty_limit);
+        porterSpotter->SetTrackMaxAge(FLAGS_track_max_age);
+        porterSpotter->SetFlowPropagation(FLAGS_flow_propagation);
+        porterSpotter->SetMotionGate(FLAGS_motion_gate, FLAGS_activity_threshold);
+        porterSpotter->SetPoseCache(FLAGS_pose_cache);
+        porterSpotter->SetProximityGatedPose(FLAGS_proximity_gated_pose);
+        porterSpotter->SetFrameTimeBudget(FLAGS_frame_time_budget_ms / 1000);
+
+        StreamIo *ioPtr = io.get();
+        const MultiStreamRunner::FrameSource source = [ioPtr](cv::Mat &image, double &timestamp) {
+            return readFrame(*ioPtr, image, timestamp);
+        };
+        const MultiStreamRunner::FrameSink sink = [ioPtr](cv::Mat &image, const std::vector<TrackedBbox> &tracks,
+                                                          const std::vector<BboxXyxy> &objectDetections) {
+            if (FLAGS_skeleton) visualization_util::drawTracksSkeleton(tracks, image);
+            if (FLAGS_person_box) visualization_util::drawPersonBbox(tracks, image);
+            if (FLAGS_output_video) ioPtr->videoWriter << image;
+        };
+        runner.AddStream(std::move(porterSpotter), source, sink);
+        streamIos.push_back(std::move(io));
+    }
+
+    std::cout << "Running " << filePaths.size() << " streams on " << runner.GetNumWorkers() << " workers with "
+              << detectorPool.Size() << " detectors and " << poseEstimatorPool.Size() << " pose estimators..."
+              << std::endl;
+    runner.Run();
+
+    for (int i = 0; i < runner.GetNumStreams(); i++)
+    {
+        streamIos[i]->videoCapture.release();
+        const PorterSpotter &porterSpotter = runner.GetPorterSpotter(i);
+        std::cout << filePaths[i] << ": " << runner.GetNumProcessedFrames(i) << " frames" << std::endl;
+        std::cout << "  Skipped frames without motion: " << porterSpotter.GetNumSkippedFrames() << " / "
+                  << porterSpotter.GetNumRunFrames() << std::endl;
+        std::cout << "  Pose inferences: " << porterSpotter.GetNumInferredPoses()
+                  << ", reused poses: " << porterSpotter.GetNumReusedPoses() << std::endl;
+        std::cout << "  Deferred poses: " << porterSpotter.GetNumDeferredPoses() << " (without previous pose: "
+                  << porterSpotter.GetNumDroppedPoses() << ") in " << porterSpotter.GetNumBudgetExceededFrames()
+                  << " frames" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -25,11 +25,25 @@
 #include "Timer.hpp"
 #include "Types.hpp"
 #include "VisualizationUtil.hpp"
+#include "pipeline/PipelinedRunner.hpp"
 #include "pipeline/PorterSpotter.hpp"
 
 // Define and parser command line arguments
 DEFINE_string(d, "./models/yolov8s.dlc", "Path to detection model DLC file");
 DEFINE_string(p, "./models/rtmpose.dlc", "Path to pose estimation model DLC file");
+DEFINE_int32(det_width, 0, "Input width of detection network (multiple of 32, with -det_height). 0: use DLC input size");
+DEFINE_int32(det_height, 0, "Input height of detection network (multiple of 32, with -det_width). 0: use DLC input size");
+DEFINE_bool(gated_association, false, "Use spatially gated sparse association in tracking (for crowded scenes)");
+DEFINE_int32(detection_interval, 1, "Run object detection every N processed frames and track by prediction in between");
+DEFINE_int32(track_max_age, 5, "Drop a track not detected for this many nominal frame intervals (0.2 s)");
+DEFINE_double(uncertainty_limit, 0, "Run object detection when track position variance exceeds this. 0: disabled");
+DEFINE_bool(flow_propagation, false, "Move person boxes by sparse optical flow on frames without detection");
+DEFINE_bool(motion_gate, false, "Skip the pipeline on frames without motion when no person is tracked");
+DEFINE_double(activity_threshold, 0.002, "Fraction of changed pixels regarded as motion (with -motion_gate)");
+DEFINE_bool(pose_cache, false, "Reuse the previous pose of stationary tracks instead of running pose estimation");
+DEFINE_bool(proximity_gated_pose, false, "Run pose estimation only for persons near a detected object");
+DEFINE_double(frame_time_budget_ms, 0, "Time budget per frame [ms]. Pose estimation beyond it is deferred. 0: none");
+DEFINE_bool(pipelined, false, "Run decoding, detection, tracking and pose, and output on separate threads");
 DEFINE_string(input_file, "videos/.sample.mp4", "Path to input video file. e.g. sample.mp4");
 DEFINE_string(output_dir, "outputs", "Path to output dir");
 DEFINE_bool(output_video, false, "Save track as annotated video");
@@ -102,18 +116,19 @@ void writeTrack(std::ofstream &trackOfs, const std::vector<TrackedBbox> &tracks)
     }
 }
 
-bool processFrame(PorterSpotter &porterSpotter, cv::Mat &image, std::vector<TrackedBbox> &tracks,
-                  std::vector<BboxXyxy> &objectDetections)
+bool processFrame(PorterSpotter &porterSpotter, cv::Mat &image, const double timestamp,
+                  std::vector<TrackedBbox> &tracks, std::vector<BboxXyxy> &objectDetections)
 {
     cv::Mat rgbImage;
     cv::cvtColor(image, rgbImage, cv::COLOR_BGR2RGB);
-    porterSpotter.Run(rgbImage, tracks, objectDetections);
+    porterSpotter.Run(rgbImage, timestamp, tracks, objectDetections);
 
     return true;
 }
 
 bool analizeVideo(PorterSpotter &porterSpotter, const std::string &filePath, const std::string &outDir,
-                  const bool isSaveVideo, const bool isDrawPersonBbox, const bool isDrawSkeleton, const bool isSaveTxt)
+                  const bool isSaveVideo, const bool isDrawPersonBbox, const bool isDrawSkeleton, const bool isSaveTxt,
+                  const bool isPipelined)
 {
     const size_t periodIdx = filePath.find_last_of(".");
     size_t slashIdx = filePath.find_last_of("/");
@@ -151,29 +166,70 @@ bool analizeVideo(PorterSpotter &porterSpotter, const std::string &filePath, con
     const double execIntervalSec = 1 / execFps;
     int frameCnt = 0;
     double secondPassed = 0;
-    while (1)
+    double timestamp = 0; // 読み込んだフレームの動画内の時刻
+    if (isPipelined)
     {
-        cv::Mat image;
-        videoCapture >> image; // videoからimageへ1フレームを取り込む
-        if (image.empty() == true)
-        {
-            break; // 画像が読み込めなかったとき、無限ループを抜ける
-        }
-        if (frameCnt == 0 || secondPassed >= execIntervalSec)
-        {
-            std::vector<TrackedBbox> tracks;
-            std::vector<BboxXyxy> objectDetections;
-            processFrame(porterSpotter, image, tracks, objectDetections);
-
+        // デコード、物体検出、追跡と姿勢推定、描画と書き出しを別のスレッドで並行に行う
+        const PipelinedRunner::FrameSource source = [&](cv::Mat &image, double &frameTimestamp) {
+            while (1)
+            {
+                videoCapture >> image;
+                if (image.empty() == true) return false;
+                const bool isExecFrame = frameCnt == 0 || secondPassed >= execIntervalSec;
+                frameTimestamp = timestamp;
+                secondPassed += readIntervalSec;
+                timestamp += readIntervalSec;
+                if (isExecFrame)
+                {
+                    secondPassed -= execIntervalSec;
+                    frameCnt++;
+                    return true;
+                }
+            }
+        };
+        const PipelinedRunner::FrameSink sink = [&](cv::Mat &image, const std::vector<TrackedBbox> &tracks,
+                                                    const std::vector<BboxXyxy> &objectDetections) {
             if (isDrawSkeleton) visualization_util::drawTracksSkeleton(tracks, image);
             if (isDrawPersonBbox) visualization_util::drawPersonBbox(tracks, image);
             if (isSaveVideo) videoWriter << image;
-            secondPassed -= execIntervalSec;
-            frameCnt++;
+        };
+        PipelinedRunner runner(porterSpotter);
+        runner.Run(source, sink);
+    }
+    else
+    {
+        while (1)
+        {
+            cv::Mat image;
+            videoCapture >> image; // videoからimageへ1フレームを取り込む
+            if (image.empty() == true)
+            {
+                break; // 画像が読み込めなかったとき、無限ループを抜ける
+            }
+            if (frameCnt == 0 || secondPassed >= execIntervalSec)
+            {
+                std::vector<TrackedBbox> tracks;
+                std::vector<BboxXyxy> objectDetections;
+                processFrame(porterSpotter, image, timestamp, tracks, objectDetections);
+
+                if (isDrawSkeleton) visualization_util::drawTracksSkeleton(tracks, image);
+                if (isDrawPersonBbox) visualization_util::drawPersonBbox(tracks, image);
+                if (isSaveVideo) videoWriter << image;
+                secondPassed -= execIntervalSec;
+                frameCnt++;
+            }
+            secondPassed += readIntervalSec;
+            timestamp += readIntervalSec;
         }
-        secondPassed += readIntervalSec;
     }
     videoCapture.release();
+    std::cout << "Skipped frames without motion: " << porterSpotter.GetNumSkippedFrames() << " / "
+              << porterSpotter.GetNumRunFrames() << std::endl;
+    std::cout << "Pose inferences: " << porterSpotter.GetNumInferredPoses()
+              << ", reused poses: " << porterSpotter.GetNumReusedPoses() << std::endl;
+    std::cout << "Deferred poses: " << porterSpotter.GetNumDeferredPoses() << " (without previous pose: "
+              << porterSpotter.GetNumDroppedPoses() << ") in " << porterSpotter.GetNumBudgetExceededFrames()
+              << " frames" << std::endl;
     return true;
 }
 
@@ -235,6 +291,20 @@ int main(int argc, char **argv)
     std::string modelType1 = "detection";
     std::string modelType2 = "pose";
     const std::vector<std::string> runtimes = {"cpu"};
+    if (!porterSpotter.SetDetectionInputSize(FLAGS_det_width, FLAGS_det_height))
+    {
+        std::cout << "Invalid detection input size" << std::endl;
+        return false;
+    }
+    porterSpotter.SetGatedAssociation(FLAGS_gated_association);
+    porterSpotter.SetDetectionInterval(FLAGS_detection_interval);
+    porterSpotter.SetUncertaintyLimit(FLAGS_uncertainty_limit);
+    porterSpotter.SetTrackMaxAge(FLAGS_track_max_age);
+    porterSpotter.SetFlowPropagation(FLAGS_flow_propagation);
+    porterSpotter.SetMotionGate(FLAGS_motion_gate, FLAGS_activity_threshold);
+    porterSpotter.SetPoseCache(FLAGS_pose_cache);
+    porterSpotter.SetProximityGatedPose(FLAGS_proximity_gated_pose);
+    porterSpotter.SetFrameTimeBudget(FLAGS_frame_time_budget_ms / 1000);
     if (!initModel(porterSpotter, modelType1, FLAGS_d, runtimes))
     {
         std::cout << "Failed to initialize detection model" << std::endl;
@@ -248,7 +318,7 @@ int main(int argc, char **argv)
 
     // Run analysis
     if (analizeVideo(porterSpotter, FLAGS_input_file, FLAGS_output_dir, FLAGS_output_video, FLAGS_person_box,
-                     FLAGS_object_box, FLAGS_skeleton))
+                     FLAGS_object_box, FLAGS_skeleton, FLAGS_pipelined))
     {
         return EXIT_SUCCESS;
     }
@@ -0,0 +1,214 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "BatchedNms.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// グリッドの1辺のセル数の上限
+static const int maxGridSize = 64;
+
+BatchedNms::BatchedNms() : iouThresholds(1, 0.5f), gridThreshold(512), topK(0) {}
+
+float BatchedNms::iouThresholdOf(const int label) const
+{
+    if (label >= 0 && label < (int)iouThresholds.size()) return iouThresholds[label];
+    return iouThresholds.back();
+}
+
+/// @brief 候補をラベル昇順、スコア降順に並べ、座標と面積を並べた順に詰める。ラベルごとに上位 topK 件だけを残す
+void BatchedNms::sortCandidates(const std::vector<NmsCandidate> &candidates)
+{
+    const int numCandidates = (int)candidates.size();
+
+    // ラベルごとに振り分ける (計数ソート)
+    int maxLabel = -1;
+    for (const NmsCandidate &c : candidates)
+    {
+        assert(c.label >= 0);
+        maxLabel = std::max(maxLabel, c.label);
+    }
+    labelOffsets.assign(maxLabel + 2, 0);
+    for (const NmsCandidate &c : candidates)
+    {
+        labelOffsets[c.label + 1]++;
+    }
+    for (int label = 0; label <= maxLabel; label++)
+    {
+        labelOffsets[label + 1] += labelOffsets[label];
+    }
+    order.resize(numCandidates);
+    labelCursors.assign(labelOffsets.begin(), labelOffsets.end() - 1);
+    for (int i = 0; i < numCandidates; i++)
+    {
+        order[labelCursors[candidates[i].label]++] = i;
+    }
+
+    // ラベルごとに上位 topK 件を選んでからスコアの降順に並べ、前に詰める
+    const auto isHigher = [&candidates](const int a, const int b) {
+        if (candidates[a].score != candidates[b].score) return candidates[a].score > candidates[b].score;
+        return a < b;
+    };
+    int n = 0;
+    for (int label = 0; label <= maxLabel; label++)
+    {
+        const std::vector<int>::iterator first = order.begin() + labelOffsets[label];
+        std::vector<int>::iterator last = order.begin() + labelOffsets[label + 1];
+        if (topK > 0 && last - first > topK)
+        {
+            std::nth_element(first, first + topK, last, isHigher);
+            last = first + topK;
+        }
+        std::sort(first, last, isHigher);
+        n = (int)(std::copy(first, last, order.begin() + n) - order.begin());
+    }
+    order.resize(n);
+
+    sorted.Clear();
+    for (int i = 0; i < n; i++)
+    {
+        const NmsCandidate &c = candidates[order[i]];
+        sorted.PushBack(c.x0, c.y0, c.x1, c.y1);
+    }
+    isKept.assign(n, 0);
+}
+
+/// @brief 並べ替え後の候補 i が、残した候補のいずれかによって抑制されるかどうか
+inline bool BatchedNms::isSuppressed(const int i, const BboxArray<float> &boxes, const float iouThreshold) const
+{
+    return BboxUtil::FindIouAbove(sorted.x0s[i], sorted.y0s[i], sorted.x1s[i], sorted.y1s[i], sorted.areas[i],
+                                  boxes, iouThreshold) >= 0;
+}
+
+void BatchedNms::suppressGreedy(const int begin, const int end, const float iouThreshold)
+{
+    keptBoxes.Clear();
+    for (int i = begin; i < end; i++)
+    {
+        if (isSuppressed(i, keptBoxes, iouThreshold)) continue;
+        keptBoxes.PushBack(sorted.x0s[i], sorted.y0s[i], sorted.x1s[i], sorted.y1s[i]);
+        isKept[i] = 1;
+    }
+}
+
+void BatchedNms::suppressWithGrid(const int begin, const int end, const float iouThreshold)
+{
+    // 候補全体を囲む範囲と平均の大きさからセルの大きさを決める
+    const std::vector<float> &x0s = sorted.x0s;
+    const std::vector<float> &y0s = sorted.y0s;
+    const std::vector<float> &x1s = sorted.x1s;
+    const std::vector<float> &y1s = sorted.y1s;
+    float minX = x0s[begin];
+    float minY = y0s[begin];
+    float maxX = x1s[begin];
+    float maxY = y1s[begin];
+    double sumW = 0.0;
+    double sumH = 0.0;
+    for (int i = begin; i < end; i++)
+    {
+        minX = std::min(minX, x0s[i]);
+        minY = std::min(minY, y0s[i]);
+        maxX = std::max(maxX, x1s[i]);
+        maxY = std::max(maxY, y1s[i]);
+        sumW += std::max(x1s[i] - x0s[i], 0.0f);
+        sumH += std::max(y1s[i] - y0s[i], 0.0f);
+    }
+    const int n = end - begin;
+    const float spanX = std::max(maxX - minX, 1.0f);
+    const float spanY = std::max(maxY - minY, 1.0f);
+    const float meanW = std::max((float)(sumW / n), 1.0f);
+    const float meanH = std::max((float)(sumH / n), 1.0f);
+    const int gridW = std::min(std::max((int)std::ceil(spanX / meanW), 1), maxGridSize);
+    const int gridH = std::min(std::max((int)std::ceil(spanY / meanH), 1), maxGridSize);
+    const float cellW = spanX / (float)gridW;
+    const float cellH = spanY / (float)gridH;
+
+    if ((int)gridCells.size() < gridW * gridH) gridCells.resize(gridW * gridH);
+    for (int c = 0; c < gridW * gridH; c++)
+    {
+        gridCells[c].Clear();
+    }
+
+    // 重なりのある2つの候補は、少なくとも1つのセルを共有する
+    for (int i = begin; i < end; i++)
+    {
+        const int cx0 = std::min(std::max((int)((x0s[i] - minX) / cellW), 0), gridW - 1);
+        const int cy0 = std::min(std::max((int)((y0s[i] - minY) / cellH), 0), gridH - 1);
+        const int cx1 = std::min(std::max((int)((x1s[i] - minX) / cellW), 0), gridW - 1);
+        const int cy1 = std::min(std::max((int)((y1s[i] - minY) / cellH), 0), gridH - 1);
+
+        bool keep = true;
+        for (int cy = cy0; cy <= cy1 && keep; cy++)
+        {
+            for (int cx = cx0; cx <= cx1 && keep; cx++)
+            {
+                keep = !isSuppressed(i, gridCells[cy * gridW + cx], iouThreshold);
+            }
+        }
+        if (!keep) continue;
+
+        isKept[i] = 1;
+        for (int cy = cy0; cy <= cy1; cy++)
+        {
+            for (int cx = cx0; cx <= cx1; cx++)
+            {
+                gridCells[cy * gridW + cx].PushBack(x0s[i], y0s[i], x1s[i], y1s[i]);
+            }
+        }
+    }
+}
+
+void BatchedNms::Run(const std::vector<NmsCandidate> &candidates, std::vector<int> &picked)
+{
+    picked.clear();
+    sortCandidates(candidates);
+
+    const int n = (int)order.size();
+    for (int begin = 0; begin < n;)
+    {
+        const int label = candidates[order[begin]].label;
+        int end = begin + 1;
+        while (end < n && candidates[order[end]].label == label)
+        {
+            end++;
+        }
+
+        // 閾値が負の場合は重なりのない候補同士も抑制し得るので、全ての候補と比較する
+        const float iouThreshold = iouThresholdOf(label);
+        if (end - begin >= gridThreshold && iouThreshold >= 0.0f)
+        {
+            suppressWithGrid(begin, end, iouThreshold);
+        }
+        else
+        {
+            suppressGreedy(begin, end, iouThreshold);
+        }
+        begin = end;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (isKept[i]) picked.push_back(order[i]);
+    }
+}
+
+void BatchedNms::Run(std::vector<NmsCandidate> &candidates)
+{
+    Run(candidates, pickedIdcs);
+
+    // 残った候補を並べ替えた順に詰め、入力と入れ替える。入れ替えたバッファは次の呼び出しで使い回す
+    compacted.resize(pickedIdcs.size());
+    for (size_t i = 0; i < pickedIdcs.size(); i++)
+    {
+        compacted[i] = candidates[pickedIdcs[i]];
+    }
+    candidates.swap(compacted);
+}
@@ -0,0 +1,80 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "tracking/BboxUtil.hpp"
+
+/// @brief NMS の入力となる検出候補 (ネットワーク入力層のピクセル座標系)
+struct NmsCandidate
+{
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+    float score;
+    int label; // クラスごとの NMS を行うためのラベル。0 から始まる連番
+
+    NmsCandidate() : x0(0.0f), y0(0.0f), x1(0.0f), y1(0.0f), score(0.0f), label(0){};
+    NmsCandidate(const float x0, const float y0, const float x1, const float y1, const float score, const int label)
+        : x0(x0), y0(y0), x1(x1), y1(y1), score(score), label(label){};
+};
+
+/// @brief クラスごとの Non-maximum suppression をまとめて行う。
+/// 候補をラベルごとに振り分け、スコア上位 topK 件だけを nth_element で選んでから並べ替える。
+/// 各候補はそれまでに残した同じラベルの候補とだけ、BboxUtil::FindIouAbove でまとめて比較する。
+/// 抑制が判明した時点で比較を打ち切り、削除は印を付けて最後にまとめて詰める。
+/// 候補数が多い場合は、残した候補を一様グリッドのセルごとに登録し、近傍のセルにある候補とだけ比較する。
+/// 作業領域はメンバーに持ち、呼び出しごとに使い回す。
+class BatchedNms
+{
+private:
+    std::vector<float> iouThresholds; // ラベルごとの IoU 閾値
+    int gridThreshold;                // この候補数以上のラベルはグリッドを使う
+    int topK;                         // ラベルごとに NMS にかける候補数の上限。0 以下は無制限
+
+    // 作業領域
+    std::vector<int> order;
+    std::vector<int> labelOffsets; // ラベルごとの order 内の開始位置
+    std::vector<int> labelCursors;
+    BboxArray<float> sorted;    // スコア順に並べた候補
+    BboxArray<float> keptBoxes; // 残した候補
+    std::vector<unsigned char> isKept;
+    std::vector<BboxArray<float>> gridCells; // セルごとの残した候補
+    std::vector<int> pickedIdcs;
+    std::vector<NmsCandidate> compacted;
+
+    float iouThresholdOf(const int label) const;
+    void sortCandidates(const std::vector<NmsCandidate> &candidates);
+    void suppressGreedy(const int begin, const int end, const float iouThreshold);
+    void suppressWithGrid(const int begin, const int end, const float iouThreshold);
+    bool isSuppressed(const int i, const BboxArray<float> &boxes, const float iouThreshold) const;
+
+public:
+    BatchedNms();
+    ~BatchedNms(){};
+
+    /// @brief 全ラベル共通の IoU 閾値を設定する
+    void SetIouThreshold(const float iouThreshold) { iouThresholds.assign(1, iouThreshold); }
+    /// @brief ラベルごとの IoU 閾値を設定する。要素数より大きいラベルには最後の閾値を使う
+    void SetIouThresholds(const std::vector<float> &iouThresholds) { this->iouThresholds = iouThresholds; }
+    /// @brief 1つのラベルの候補数がこの値以上のとき、グリッドによる近傍探索を使う
+    void SetGridThreshold(const int gridThreshold) { this->gridThreshold = gridThreshold; }
+    /// @brief ラベルごとに NMS にかける候補をスコア上位 topK 件に制限する。0 以下は無制限
+    void SetTopK(const int topK) { this->topK = topK; }
+
+    /// @brief NMS を実行し、残った候補のインデックスをラベル昇順、スコア降順に picked へ格納する。
+    /// 同じスコアの候補は入力の順に並ぶ。IoU が閾値を超えた候補を抑制する。ラベルは 0 以上とする。
+    void Run(const std::vector<NmsCandidate> &candidates, std::vector<int> &picked);
+
+    /// @brief NMS を実行し、残った候補だけをラベル昇順、スコア降順に candidates へ詰める
+    void Run(std::vector<NmsCandidate> &candidates);
+};
@@ -37,7 +37,7 @@ void Yolov5::makeFloatImg(const cv::Mat &input, cv::Mat &output)
 }
 
 void Yolov5::decode_output(const zdl::DlSystem::TensorMap &tensorMap, std::vector<Yolov5Util::Object> &objects,
-                           const float scale, const cv::Vec2i &delta, const int w_img, const int h_img) const
+                           const float scale, const cv::Vec2i &delta, const int w_img, const int h_img)
 {
     // 3 layers from the network:
     // 376_Reshape_257.ncs, 395_Reshape_272.ncs, and 414_Reshape_287.ncs,
@@ -90,10 +90,9 @@ void Yolov5::decode_output(const zdl::DlSystem::TensorMap &tensorMap, std::vecto
         }
     }
 
-    // NMS
-    Yolov5Util::qsort_descent_inplace(proposals);
+    // NMS (スコア上位 nmsTopK 件のみを対象とする)
     std::vector<int> picked;
-    Yolov5Util::nms_sorted_bboxes(proposals, picked, iouThreshold);
+    Yolov5Util::nms_bboxes(proposals, nms, picked);
 
     // Scaling
     const int num_picked = (int)picked.size();
@@ -157,8 +156,8 @@ void Yolov5::saveFeatureMap(const zdl::DlSystem::TensorMap &tensorMap, const int
 Yolov5::Yolov5() : isNetworkReady(false)
 {
     scoreThreshold = 0.35;
-    iouThreshold = 0.35;
-    nmsTopK = 100;
+    SetIoUThreshold(0.35);
+    SetNmsTopK(100);
     isNetworkFedBgr = false;
 }
 
@@ -17,8 +17,7 @@ class Yolov5 final
 {
 private:
     float scoreThreshold;
-    float iouThreshold;
-    int nmsTopK;
+    BatchedNms nms; // IoU 閾値と top-K を設定した NMS。作業領域を推論ごとに使い回す
 
     bool isNetworkFedBgr;
     bool isNetworkReady;
@@ -32,15 +31,16 @@ private:
     static void saveFeatureMap(const zdl::DlSystem::TensorMap &tensorMap, const int w_img, const int h_img);
 
     void decode_output(const zdl::DlSystem::TensorMap &tensorMap, std::vector<Yolov5Util::Object> &objects,
-                       const float scale, const cv::Vec2i &delta, const int w_img, const int h_img) const;
+                       const float scale, const cv::Vec2i &delta, const int w_img, const int h_img);
 
 public:
     Yolov5();
     ~Yolov5();
 
     void SetScoreThreshold(const float scoreThreshold) { this->scoreThreshold = scoreThreshold; }
-    void SetIoUThreshold(const float iouThreshold) { this->iouThreshold = iouThreshold; }
-    void SetNmsTopK(const unsigned int nmsTopK) { this->nmsTopK = nmsTopK; }
+    void SetIoUThreshold(const float iouThreshold) { nms.SetIouThreshold(iouThreshold); }
+    /// @brief NMS にかける候補をスコア上位 nmsTopK 件に制限する。0 は無制限
+    void SetNmsTopK(const unsigned int nmsTopK) { nms.SetTopK((int)nmsTopK); }
     bool IsNetworkFedBgr() const { return isNetworkFedBgr; }
     bool IsNetworkReady() const { return isNetworkReady; }
 
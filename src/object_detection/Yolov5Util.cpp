@@ -57,77 +57,18 @@ void Yolov5Util::resize(const cv::Mat &input, const cv::Size &target_shape, cv::
     resized.copyTo(output(cv::Rect(delta[0], delta[1], size_unpad.width, size_unpad.height)));
 }
 
-void Yolov5Util::qsort_descent_inplace(std::vector<Object> &objects)
+void Yolov5Util::nms_bboxes(const std::vector<Object> &objects, BatchedNms &nms, std::vector<int> &picked)
 {
-    if (objects.empty()) return;
+    const int n = (int)objects.size();
 
-    qsort_descent_inplace(objects, 0, (int)objects.size() - 1);
-}
-
-void Yolov5Util::qsort_descent_inplace(std::vector<Object> &faceobjects, int left, int right)
-{
-    int i = left;
-    int j = right;
-    float p = faceobjects[(left + right) / 2].prob;
-
-    while (i <= j)
-    {
-        while (faceobjects[i].prob > p)
-            i++;
-
-        while (faceobjects[j].prob < p)
-            j--;
-
-        if (i <= j)
-        {
-            // swap
-            std::swap(faceobjects[i], faceobjects[j]);
-
-            i++;
-            j--;
-        }
-    }
-
-    {
-        {
-            if (left < j) qsort_descent_inplace(faceobjects, left, j);
-        }
-        {
-            if (i < right) qsort_descent_inplace(faceobjects, i, right);
-        }
-    }
-}
-
-void Yolov5Util::nms_sorted_bboxes(const std::vector<Object> &faceobjects, std::vector<int> &picked, float nms_threshold)
-{
-    picked.clear();
-
-    const int n = (int)faceobjects.size();
-
-    std::vector<float> areas(n);
+    std::vector<NmsCandidate> candidates(n);
     for (int i = 0; i < n; i++)
     {
-        areas[i] = faceobjects[i].rect.area();
+        const cv::Rect2f &rect = objects[i].rect;
+        candidates[i] = NmsCandidate(rect.x, rect.y, rect.x + rect.width, rect.y + rect.height, objects[i].prob, 0);
     }
 
-    for (int i = 0; i < n; i++)
-    {
-        const Object &a = faceobjects[i];
-
-        int keep = 1;
-        for (int j = 0; j < (int)picked.size(); j++)
-        {
-            const Object &b = faceobjects[picked[j]];
-
-            // intersection over union
-            float inter_area = intersection_area(a, b);
-            float union_area = areas[i] + areas[picked[j]] - inter_area;
-            // IoU = inter_area / union_area
-            if (inter_area / union_area > nms_threshold) keep = 0;
-        }
-
-        if (keep) picked.push_back(i);
-    }
+    nms.Run(candidates, picked);
 }
 
 void Yolov5Util::generateDetectedObject(const std::vector<Object> &src, std::vector<BboxXyxy> &tgt, const int w_img,
@@ -7,6 +7,7 @@
  * without the prior consent of Safie Inc.
  */
 
+#include "BatchedNms.hpp"
 #include "Types.hpp"
 
 /// @brief Yolov5 のユーティリティ関数
@@ -25,23 +26,12 @@ namespace Yolov5Util
         return 1.0f / (1.0f + z);
     }
 
-    inline float intersection_area(const Object &a, const Object &b)
-    {
-        cv::Rect2f inter = a.rect & b.rect;
-        return inter.area();
-    }
-
     /// @brief Resize with padding. Keep the input aspect ratio of unpadded image.
     void resize(const cv::Mat &input, const cv::Size &target_shape, cv::Mat &output, float &scale, cv::Vec2i &delta);
 
-    /// @brief Sort object by probability.
-    void qsort_descent_inplace(std::vector<Object> &objects);
-
-    /// @brief Sort object by probability.
-    void qsort_descent_inplace(std::vector<Object> &faceobjects, int left, int right);
-
-    /// @brief Non-maximum supression with sorted object by probability.
-    void nms_sorted_bboxes(const std::vector<Object> &faceobjects, std::vector<int> &picked, float nms_threshold);
+    /// @brief Non-maximum supression. Objects do not need to be sorted; picked indices are in descending order of
+    /// probability. The IoU threshold and top-K limit are those configured in nms, which keeps its work buffers.
+    void nms_bboxes(const std::vector<Object> &objects, BatchedNms &nms, std::vector<int> &picked);
 
     /// @brief Transform from Object to DetectedObject type.
     void generateDetectedObject(const std::vector<Object> &src, std::vector<BboxXyxy> &tgt, const int w_img,
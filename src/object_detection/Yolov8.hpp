@@ -9,35 +9,85 @@
 
 #pragma once
 
+#include "BatchedNms.hpp"
 #include "IMultiClassDetector.hpp"
+#include "Letterbox.hpp"
+#include "DlContainer/IDlContainer.hpp"
+#include "DlSystem/RuntimeList.hpp"
+#include "DlSystem/StringList.hpp"
+#include "DlSystem/TensorShapeMap.hpp"
 #include "SNPE/SNPE.hpp"
+#include "SnpeIoBuffers.hpp"
 #include "Types.hpp"
 
 class Yolov8 : IMultiClassDetector
 {
 public:
-    struct BoundingBox; // FIXME: 消す
+    /// @brief 検出対象のクラス。推論結果はこの並び順でクラスごとに返す。
+    struct TargetClass
+    {
+        int classId;          // COCO のクラスID (0: person, 39: bottle, 67: cell phone, ...)
+        float scoreThreshold; // スコアの閾値
+        float iouThreshold;   // NMS の IoU 閾値
+
+        TargetClass(const int classId, const float scoreThreshold, const float iouThreshold)
+            : classId(classId), scoreThreshold(scoreThreshold), iouThreshold(iouThreshold){};
+    };
 
 private:
     int image_width;
     int image_height;
-    float ratio;
-    int paddingWidthIdx;
-    int paddingHeightIdx;
+    int inputWidth;  // ネットワーク入力の幅
+    int inputHeight; // ネットワーク入力の高さ
+
+    int requestedInputWidth;  // SetInputSize() で指定した入力の幅。0 なら DLC のまま
+    int requestedInputHeight; // SetInputSize() で指定した入力の高さ。0 なら DLC のまま
+
+    bool isUserBufferMode; // 入出力にユーザーバッファを使うかどうか
+
+    std::vector<TargetClass> targetClasses;
+    std::vector<int> candidateIdcs;       // デコード時に閾値を超えたアンカーのインデックス
+    std::vector<NmsCandidate> candidates; // デコード結果。推論ごとに使い回す
+    BatchedNms nms;
+
+    Letterbox letterbox;
 
     std::unique_ptr<zdl::SNPE::SNPE> network;
+    SnpeIoBuffers ioBuffers; // 推論ごとに使い回す入出力バッファ
 
-    void preprocess(const cv::Mat &rawImg, cv::Mat &resizedImg);
-    void postprocess(const std::vector<std::vector<BoundingBox>> &decoded, std::vector<std::vector<BboxXyxy>> &result);
+    std::unique_ptr<zdl::SNPE::SNPE> buildNetwork(zdl::DlContainer::IDlContainer *container,
+                                                  const zdl::DlSystem::RuntimeList &runtimeList,
+                                                  const zdl::DlSystem::StringList &outputTensorNames,
+                                                  const zdl::DlSystem::TensorShapeMap *inputDimensions) const;
+
+    void preprocess(const cv::Mat &rawImg, float *inputData);
+    void decodeOutput(std::vector<NmsCandidate> &decoded);
+    void postprocess(std::vector<NmsCandidate> &candidates, std::vector<std::vector<BboxXyxy>> &result);
 
 public:
-    Yolov8(){};
+    Yolov8();
     ~Yolov8(){};
 
+    /// @brief 検出対象のクラスとクラスごとの閾値を設定する。対象クラスのスコアチャンネルだけを走査するので、
+    /// クラスを1つ追加するコストはチャンネル1つ分の走査で済む。
+    void SetTargetClasses(const std::vector<TargetClass> &targetClasses);
+    const std::vector<TargetClass> &GetTargetClasses() const { return targetClasses; }
+
+    /// @brief クラスごとに NMS にかける候補をスコア上位 nmsTopK 件に制限する。0 は無制限
+    void SetNmsTopK(const unsigned int nmsTopK) { nms.SetTopK((int)nmsTopK); }
+
+    /// @brief ネットワークの入力サイズを指定する。CreateNetwork() の前に呼ぶ。
+    /// 16:9 のカメラに 640x384 のような横長の入力を使うと、パディングに費やす計算を減らせる。
+    /// 幅と高さは 32 の倍数。両方に 0 を指定すると DLC の入力サイズを使う。片方だけ 0 の場合は false を返す。
+    bool SetInputSize(const int width, const int height);
+
+    /// @brief ユーザーバッファモードを切り替える。CreateNetwork() の前に呼ぶ。
+    void SetUserBufferMode(const bool isUserBufferMode) { this->isUserBufferMode = isUserBufferMode; }
+
     bool CreateNetwork(const uint8_t *buffer, const size_t size, const std::vector<std::string> &runtimes);
 
-    /// @brief 人物、頭、顔を検出する
+    /// @brief 対象クラスの物体を検出する
     /// @param image 任意のアスペクト比とサイズの画像（例: 1280 x 720）
-    /// @param result 入力画像のピクセル座標系のBBOX
+    /// @param result 入力画像のピクセル座標系のBBOX。SetTargetClasses() で指定したクラスの順に並ぶ
     bool Infer(const cv::Mat &image, std::vector<std::vector<BboxXyxy>> &result) override;
 };
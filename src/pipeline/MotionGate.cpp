@@ -0,0 +1,52 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "MotionGate.hpp"
+
+#include <cmath>
+
+MotionGate::MotionGate() : processingWidth(160), pixelThreshold(25), activityThreshold(0.002), lastActivity(0.0) {}
+
+void MotionGate::Reset()
+{
+    referenceGray.release();
+    lastActivity = 0.0;
+}
+
+bool MotionGate::HasMotion(const cv::Mat &rgbImage)
+{
+    // 縮小して平滑化し、センサーのノイズや圧縮のノイズを抑える
+    if (rgbImage.cols > processingWidth)
+    {
+        const int height = (int)std::round((double)rgbImage.rows * processingWidth / rgbImage.cols);
+        cv::resize(rgbImage, resized, cv::Size(processingWidth, height), 0, 0, cv::INTER_AREA);
+        cv::cvtColor(resized, currGray, cv::COLOR_RGB2GRAY);
+    }
+    else
+    {
+        cv::cvtColor(rgbImage, currGray, cv::COLOR_RGB2GRAY);
+    }
+    cv::GaussianBlur(currGray, currGray, cv::Size(5, 5), 0);
+
+    if (referenceGray.empty() || referenceGray.size() != currGray.size())
+    {
+        lastActivity = 1.0;
+        return true;
+    }
+
+    cv::absdiff(currGray, referenceGray, diff);
+    cv::threshold(diff, diff, pixelThreshold, 255, cv::THRESH_BINARY);
+    lastActivity = (double)cv::countNonZero(diff) / diff.total();
+    return lastActivity > activityThreshold;
+}
+
+void MotionGate::UpdateReference()
+{
+    currGray.copyTo(referenceGray);
+}
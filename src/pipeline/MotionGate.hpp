@@ -0,0 +1,52 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+/// @brief 縮小したフレームの差分で、シーンに動きがあるかどうかを判定する。
+/// 基準のフレームと今のフレームを縮小・平滑化したグレースケールで比べ、輝度の差が pixelThreshold を超える画素の割合が
+/// activityThreshold を超えたら動きありとする。基準のフレームは UpdateReference() を呼んだときだけ更新するので、
+/// ゆっくりした動きも基準からの差分として蓄積されて検出される。
+class MotionGate
+{
+private:
+    int processingWidth;      // 差分を計算する画像の幅 [pixel]
+    int pixelThreshold;       // 変化したとみなす輝度の差
+    double activityThreshold; // 動きありとする変化した画素の割合
+
+    cv::Mat referenceGray; // 基準のフレーム
+
+    // 作業領域
+    cv::Mat resized;
+    cv::Mat currGray;
+    cv::Mat diff;
+
+    double lastActivity; // 直前の HasMotion() で求めた変化した画素の割合
+
+public:
+    MotionGate();
+    ~MotionGate(){};
+
+    void SetProcessingWidth(const int processingWidth) { this->processingWidth = processingWidth; }
+    void SetPixelThreshold(const int pixelThreshold) { this->pixelThreshold = pixelThreshold; }
+    /// @brief 動きありとする変化した画素の割合 (0 から 1)
+    void SetActivityThreshold(const double activityThreshold) { this->activityThreshold = activityThreshold; }
+    double GetLastActivity() const { return lastActivity; }
+
+    /// @brief 基準のフレームを捨てる。次の HasMotion() は必ず true を返す
+    void Reset();
+
+    /// @brief 基準のフレームから動きがあるかどうか。基準のフレームがない場合と大きさが違う場合は true
+    bool HasMotion(const cv::Mat &rgbImage);
+
+    /// @brief 直前の HasMotion() に与えたフレームを基準のフレームにする
+    void UpdateReference();
+};
@@ -0,0 +1,106 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "MultiStreamRunner.hpp"
+
+#include <algorithm>
+#include <thread>
+
+MultiStreamRunner::MultiStreamRunner(const int numWorkers) : numWorkers(numWorkers), numActiveStreams(0)
+{
+    if (this->numWorkers <= 0) this->numWorkers = std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+int MultiStreamRunner::AddStream(std::unique_ptr<PorterSpotter> porterSpotter, const FrameSource &source,
+                                 const FrameSink &sink)
+{
+    Stream stream;
+    stream.porterSpotter = std::move(porterSpotter);
+    stream.source = source;
+    stream.sink = sink;
+    stream.numProcessedFrames = 0;
+    streams.push_back(std::move(stream));
+    return (int)streams.size() - 1;
+}
+
+/// @brief 映像の次のフレームを1つ処理する
+/// @retval 映像が終わっていれば false
+bool MultiStreamRunner::processFrame(Stream &stream)
+{
+    double timestamp;
+    if (!stream.source(stream.image, timestamp)) return false;
+    cv::cvtColor(stream.image, stream.rgbImage, cv::COLOR_BGR2RGB);
+    stream.tracks.clear();
+    stream.objectDetections.clear();
+    stream.porterSpotter->Run(stream.rgbImage, timestamp, stream.tracks, stream.objectDetections);
+    stream.sink(stream.image, stream.tracks, stream.objectDetections);
+    stream.numProcessedFrames++;
+    return true;
+}
+
+void MultiStreamRunner::workerLoop()
+{
+    while (1)
+    {
+        int streamIdx;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]() { return !readyStreams.empty() || numActiveStreams == 0; });
+            if (readyStreams.empty()) return; // 全ての映像が終わった
+            streamIdx = readyStreams.front();
+            readyStreams.pop_front();
+        }
+
+        const bool hasNext = processFrame(streams[streamIdx]);
+
+        bool isFinished = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (hasNext)
+            {
+                readyStreams.push_back(streamIdx);
+            }
+            else
+            {
+                numActiveStreams--;
+                isFinished = numActiveStreams == 0;
+            }
+        }
+        if (hasNext)
+        {
+            // 戻した映像は1つのワーカーが処理すればよい
+            ready.notify_one();
+        }
+        else if (isFinished)
+        {
+            // 最後の映像が終わったときは、待っている全てのワーカーを終わらせる
+            ready.notify_all();
+        }
+    }
+}
+
+void MultiStreamRunner::Run()
+{
+    readyStreams.clear();
+    for (int i = 0; i < (int)streams.size(); i++)
+    {
+        readyStreams.push_back(i);
+    }
+    numActiveStreams = (int)streams.size();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < numWorkers; i++)
+    {
+        workers.push_back(std::thread(&MultiStreamRunner::workerLoop, this));
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "Types.hpp"
+#include "pipeline/PorterSpotter.hpp"
+
+/// @brief 複数の映像を、決まった数のワーカースレッドで並行に処理する。
+/// 映像ごとに PorterSpotter (追跡と姿勢の履歴) を持ち、ネットワークは PorterSpotter::SetModelPools() で共有の
+/// pool から借りる。次のフレームを処理できる映像の番号を作業キューに入れ、空いたワーカーが1フレームずつ処理して
+/// キューに戻す。1つの映像を同時に処理するワーカーは1つだけなので、映像ごとの結果はフレームの順に求まる。
+/// 映像の数が増えてもネットワークの数は変わらないので、メモリはほぼ一定のまま全てのコアを使える。
+/// pool のネットワークが同時に処理中のワーカーの数 (ワーカーと映像の少ない方) より少ないと、ワーカーはネットワークが
+/// 返されるのを待つ。
+class MultiStreamRunner
+{
+public:
+    /// @brief 次のフレームを image (BGR) に読み込み、フレームの時刻 [秒] を timestamp に書き込む。終わりなら false
+    using FrameSource = std::function<bool(cv::Mat &image, double &timestamp)>;
+    /// @brief フレームの結果を受け取る。image は読み込んだ BGR 画像で、描画してよい。
+    /// 1つの映像の sink はフレームの順に呼ばれるが、呼ぶスレッドはフレームごとに変わりうる
+    using FrameSink = std::function<void(cv::Mat &image, const std::vector<TrackedBbox> &tracks,
+                                         const std::vector<BboxXyxy> &objectDetections)>;
+
+private:
+    /// @brief 映像ごとの状態
+    struct Stream
+    {
+        std::unique_ptr<PorterSpotter> porterSpotter;
+        FrameSource source;
+        FrameSink sink;
+        cv::Mat image;
+        cv::Mat rgbImage;
+        std::vector<TrackedBbox> tracks;
+        std::vector<BboxXyxy> objectDetections;
+        int numProcessedFrames;
+    };
+
+    int numWorkers;
+    std::vector<Stream> streams;
+
+    // 作業キュー
+    std::deque<int> readyStreams; // 次のフレームを処理できる映像の番号
+    int numActiveStreams;         // まだ終わっていない映像の数
+    std::mutex mutex;
+    std::condition_variable ready;
+
+    bool processFrame(Stream &stream);
+    void workerLoop();
+
+public:
+    /// @param numWorkers ワーカースレッドの数。0 以下ならコアの数
+    MultiStreamRunner(const int numWorkers = 0);
+    ~MultiStreamRunner(){};
+
+    /// @brief 映像を加える。porterSpotter は設定を済ませ、SetModelPools() で共有のネットワークを指定しておく
+    /// @retval 映像の番号
+    int AddStream(std::unique_ptr<PorterSpotter> porterSpotter, const FrameSource &source, const FrameSink &sink);
+
+    /// @brief 全ての映像を最後まで処理する
+    void Run();
+
+    int GetNumWorkers() const { return numWorkers; }
+    int GetNumStreams() const { return (int)streams.size(); }
+    int GetNumProcessedFrames(const int streamIdx) const { return streams[streamIdx].numProcessedFrames; }
+    const PorterSpotter &GetPorterSpotter(const int streamIdx) const { return *streams[streamIdx].porterSpotter; }
+};
@@ -0,0 +1,100 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "PipelinedRunner.hpp"
+
+#include <algorithm>
+#include <thread>
+
+PipelinedRunner::PipelinedRunner(PorterSpotter &porterSpotter, const int queueCapacity)
+    : porterSpotter(porterSpotter), queueCapacity(std::max(queueCapacity, 1))
+{
+}
+
+void PipelinedRunner::decodeStage(const FrameSource &source, SpscQueue<Frame *> &freeFrames,
+                                  SpscQueue<Frame *> &decodedFrames)
+{
+    int index = 0;
+    Frame *frame;
+    while (freeFrames.Pop(frame))
+    {
+        if (!source(frame->image, frame->timestamp)) break;
+        cv::cvtColor(frame->image, frame->rgbImage, cv::COLOR_BGR2RGB);
+        frame->index = index++;
+        decodedFrames.Push(frame);
+    }
+    decodedFrames.Close();
+}
+
+void PipelinedRunner::detectStage(SpscQueue<Frame *> &decodedFrames, SpscQueue<Frame *> &detectedFrames)
+{
+    Frame *frame;
+    while (decodedFrames.Pop(frame))
+    {
+        // 追跡の段で使う可能性のあるフレームだけ検出する。検出器を使うのはこの段だけで、追跡の段では検出しない
+        frame->multiclassDetections.clear();
+        if (porterSpotter.MayDetect(frame->index))
+        {
+            porterSpotter.Detect(frame->rgbImage, frame->multiclassDetections);
+        }
+        detectedFrames.Push(frame);
+    }
+    detectedFrames.Close();
+}
+
+void PipelinedRunner::trackStage(SpscQueue<Frame *> &detectedFrames, SpscQueue<Frame *> &trackedFrames)
+{
+    Frame *frame;
+    while (detectedFrames.Pop(frame))
+    {
+        frame->tracks.clear();
+        frame->objectDetections.clear();
+        porterSpotter.RunTracking(frame->rgbImage, frame->timestamp, frame->multiclassDetections, frame->tracks,
+                                  frame->objectDetections);
+        trackedFrames.Push(frame);
+    }
+    trackedFrames.Close();
+}
+
+int PipelinedRunner::Run(const FrameSource &source, const FrameSink &sink)
+{
+    porterSpotter.ResetTracker();
+
+    // 3つのキューがいっぱいで、4つの段がそれぞれ1フレームを処理していても足りるだけ用意する
+    const int numFrames = 3 * queueCapacity + 4;
+    frames.resize(numFrames);
+    SpscQueue<Frame *> freeFrames(numFrames);
+    SpscQueue<Frame *> decodedFrames(queueCapacity);
+    SpscQueue<Frame *> detectedFrames(queueCapacity);
+    SpscQueue<Frame *> trackedFrames(queueCapacity);
+    for (Frame &frame : frames)
+    {
+        freeFrames.Push(&frame);
+    }
+
+    std::thread decodeThread(&PipelinedRunner::decodeStage, this, std::cref(source), std::ref(freeFrames),
+                             std::ref(decodedFrames));
+    std::thread detectThread(&PipelinedRunner::detectStage, this, std::ref(decodedFrames), std::ref(detectedFrames));
+    std::thread trackThread(&PipelinedRunner::trackStage, this, std::ref(detectedFrames), std::ref(trackedFrames));
+
+    // 結果を受け取った順に返すので、フレームの順は読み込んだ順のまま
+    int numProcessed = 0;
+    Frame *frame;
+    while (trackedFrames.Pop(frame))
+    {
+        sink(frame->image, frame->tracks, frame->objectDetections);
+        numProcessed++;
+        freeFrames.Push(frame);
+    }
+
+    decodeThread.join();
+    detectThread.join();
+    trackThread.join();
+    return numProcessed;
+}
@@ -0,0 +1,63 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <functional>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "Types.hpp"
+#include "pipeline/PorterSpotter.hpp"
+#include "pipeline/SpscQueue.hpp"
+
+/// @brief PorterSpotter の処理を、デコード、物体検出、追跡と姿勢推定、結果の受け取り (描画と書き出し) の4段に分け、
+/// それぞれ別のスレッドで実行する。段の間は容量固定の SpscQueue でつなぎ、フレームのバッファは使い回す。
+/// 追跡以降は1つのスレッドがフレームの順に処理するので、結果は PorterSpotter::Run() を順に呼んだ場合と同じになる。
+/// スループットは全段の合計ではなく、最も遅い段の処理時間で決まる。
+class PipelinedRunner
+{
+public:
+    /// @brief 次のフレームを image (BGR) に読み込み、フレームの時刻 [秒] を timestamp に書き込む。終わりなら false
+    using FrameSource = std::function<bool(cv::Mat &image, double &timestamp)>;
+    /// @brief フレームの結果を受け取る。image は読み込んだ BGR 画像で、描画してよい
+    using FrameSink = std::function<void(cv::Mat &image, const std::vector<TrackedBbox> &tracks,
+                                         const std::vector<BboxXyxy> &objectDetections)>;
+
+private:
+    /// @brief 段の間で受け渡すフレームのバッファ
+    struct Frame
+    {
+        int index; // ResetTracker() からのフレーム番号
+        double timestamp;
+        cv::Mat image;    // 読み込んだ BGR 画像
+        cv::Mat rgbImage; // ネットワークに入力する RGB 画像
+        std::vector<std::vector<BboxXyxy>> multiclassDetections;
+        std::vector<TrackedBbox> tracks;
+        std::vector<BboxXyxy> objectDetections;
+    };
+
+    PorterSpotter &porterSpotter;
+    int queueCapacity;
+    std::vector<Frame> frames;
+
+    void decodeStage(const FrameSource &source, SpscQueue<Frame *> &freeFrames, SpscQueue<Frame *> &decodedFrames);
+    void detectStage(SpscQueue<Frame *> &decodedFrames, SpscQueue<Frame *> &detectedFrames);
+    void trackStage(SpscQueue<Frame *> &detectedFrames, SpscQueue<Frame *> &trackedFrames);
+
+public:
+    /// @param queueCapacity 段の間のキューに入るフレーム数
+    PipelinedRunner(PorterSpotter &porterSpotter, const int queueCapacity = 2);
+    ~PipelinedRunner(){};
+
+    /// @brief source のフレームを全て処理し、フレームの順に sink を呼ぶ。sink は呼び出したスレッドで実行する。
+    /// 最初に PorterSpotter::ResetTracker() を呼ぶ
+    /// @retval 処理したフレーム数
+    int Run(const FrameSource &source, const FrameSink &sink);
+};
@@ -14,6 +14,8 @@ void checkObjectHolding(std::vector<TrackedBbox> &tracks, std::vector<BboxXyxy>
 {
     for (TrackedBbox &track : tracks)
     {
+        if (track.poseKeypoints.size() <= 6) continue; // 姿勢を推定していない人物
+
         PosePoint rightHandPoint = track.poseKeypoints[5]; // 右手
         PosePoint leftHandPoint = track.poseKeypoints[6];  // 左手
 
@@ -37,10 +39,40 @@ void checkObjectHolding(std::vector<TrackedBbox> &tracks, std::vector<BboxXyxy>
     }
 }
 
+/// @brief 人物のボックスの近くに対象物の中心があるかどうか。checkObjectHolding() で手の位置から判定する範囲を、
+/// ボックスの大きさだけで少し広めに見積もる (関節点はボックスを少し広げたクロップから推定されるため)
+static bool isNearObject(const BboxXyxy &body, const std::vector<BboxXyxy> &objectDetections)
+{
+    const double width = body.x1 - body.x0;
+    const double height = body.y1 - body.y0;
+    const double margin = width / 2 + 0.1 * std::max(width, height);
+    for (const BboxXyxy &object : objectDetections)
+    {
+        const double objectCenterX = (object.x0 + object.x1) / 2;
+        const double objectCenterY = (object.y0 + object.y1) / 2;
+        if (objectCenterX > body.x0 - margin && objectCenterX < body.x1 + margin &&
+            objectCenterY > body.y0 - margin && objectCenterY < body.y1 + margin)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 PorterSpotter::PorterSpotter()
 {
+    detectorPool = nullptr;
     isDetectionModelReady = false;
     isPoseEstimatorModelReady = false;
+    detectionInterval = 1;
+    uncertaintyLimit = 0.0;
+    numFramesSinceDetection = -1;
+    isFlowPropagation = false;
+    isMotionGate = false;
+    isProximityGatedPose = false;
+    frameTimeBudget = 0.0;
+    numRunFrames = 0;
+    numSkippedFrames = 0;
 
     const bool isSortOn = false;
     const double confidenceThreshold = 0.35;
@@ -77,22 +109,215 @@ bool PorterSpotter::InitializePoseEstimator(const uint8_t *buffer, const size_t
     }
 }
 
-void PorterSpotter::ResetTracker() { byte.Reset(); }
+void PorterSpotter::SetMotionGate(const bool isMotionGate, const double activityThreshold)
+{
+    this->isMotionGate = isMotionGate;
+    motionGate.SetActivityThreshold(activityThreshold);
+    motionGate.Reset();
+    holdingTrackIds.clear();
+}
+
+void PorterSpotter::SetModelPools(ResourcePool<Yolov8> *detectorPool, ResourcePool<PoseEstimator> *poseEstimatorPool)
+{
+    this->detectorPool = detectorPool;
+    poseEstimator.SetNetworkPool(poseEstimatorPool);
+    isDetectionModelReady = detectorPool != nullptr;
+    isPoseEstimatorModelReady = poseEstimatorPool != nullptr;
+}
+
+void PorterSpotter::ResetTracker()
+{
+    byte.Reset();
+    numFramesSinceDetection = -1;
+    lastObjectDetections.clear();
+    flowPropagator.Reset();
+    motionGate.Reset();
+    holdingTrackIds.clear();
+}
+
+/// @brief このフレームで物体検出を行うかどうか
+bool PorterSpotter::isDetectionFrame() const
+{
+    if (numFramesSinceDetection < 0 || numFramesSinceDetection + 1 >= detectionInterval) return true;
+    return uncertaintyLimit > 0.0 && byte.GetMaxPositionVariance() > uncertaintyLimit;
+}
+
+/// @brief 姿勢推定を行う。フレームの処理時間の予算があれば、対象物の近くにいる人物と対象物を持っていた人物を優先し、
+/// startTime から予算の時間が過ぎる前に終わる分だけ推定する
+/// @param liveTrackIds targets が一部の人物のとき、姿勢の履歴を残す全人物のトラック ID
+void PorterSpotter::estimatePoses(const cv::Mat &rgbImage, const std::chrono::steady_clock::time_point startTime,
+                                  const std::vector<BboxXyxy> &objectDetections, std::vector<TrackedBbox> &targets,
+                                  const std::vector<int> *liveTrackIds)
+{
+    if (frameTimeBudget <= 0.0)
+    {
+        poseEstimator.Exec(rgbImage, targets, liveTrackIds);
+        return;
+    }
+
+    isPoseTargetPrioritized.resize(targets.size());
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        const bool isPrioritized =
+            holdingTrackIds.count(targets[i].id) > 0 || isNearObject(targets[i].bodyBbox, objectDetections);
+        isPoseTargetPrioritized[i] = isPrioritized ? 1 : 0;
+    }
+    const std::chrono::duration<double> budget(frameTimeBudget);
+    const std::chrono::steady_clock::time_point deadline =
+        startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget);
+    poseEstimator.Exec(rgbImage, targets, isPoseTargetPrioritized, deadline, liveTrackIds);
+}
 
 void PorterSpotter::Run(const cv::Mat &rgbImage, std::vector<TrackedBbox> &tracks, std::vector<BboxXyxy> &objectDetections)
 {
-    // 物体検出
-    std::vector<std::vector<BboxXyxy>> multiclassDetections;
-    yolov8.Infer(rgbImage, multiclassDetections);
+    run(rgbImage, nullptr, nullptr, tracks, objectDetections);
+}
+
+void PorterSpotter::Run(const cv::Mat &rgbImage, const double timestamp, std::vector<TrackedBbox> &tracks,
+                        std::vector<BboxXyxy> &objectDetections)
+{
+    run(rgbImage, &timestamp, nullptr, tracks, objectDetections);
+}
+
+void PorterSpotter::Detect(const cv::Mat &rgbImage, std::vector<std::vector<BboxXyxy>> &multiclassDetections)
+{
+    multiclassDetections.clear();
+    detect(rgbImage, multiclassDetections);
+    // 推論に失敗した場合は人物も対象物もないものとする
+    if (multiclassDetections.size() < 2) multiclassDetections.resize(2);
+}
+
+void PorterSpotter::detect(const cv::Mat &rgbImage, std::vector<std::vector<BboxXyxy>> &multiclassDetections)
+{
+    if (detectorPool == nullptr)
+    {
+        yolov8.Infer(rgbImage, multiclassDetections);
+        return;
+    }
+    ResourcePool<Yolov8>::Lease detector(*detectorPool);
+    detector->Infer(rgbImage, multiclassDetections);
+}
+
+bool PorterSpotter::MayDetect(const int frameIndex) const
+{
+    // 位置の分散や動きで検出するかどうかが変わる場合は、前もって決められない
+    if (uncertaintyLimit > 0.0 || isMotionGate) return true;
+    return frameIndex % detectionInterval == 0;
+}
+
+void PorterSpotter::RunTracking(const cv::Mat &rgbImage, const double timestamp,
+                                const std::vector<std::vector<BboxXyxy>> &multiclassDetections,
+                                std::vector<TrackedBbox> &tracks, std::vector<BboxXyxy> &objectDetections)
+{
+    run(rgbImage, &timestamp, &multiclassDetections, tracks, objectDetections);
+}
 
-    // 追跡
-    const std::vector<BboxXyxy> &personDetections = multiclassDetections[0];
-    byte.Exec(personDetections, tracks);
+/// @param timestamp フレームの時刻 [秒]。nullptr の場合は1回の実行を基準のフレーム間隔として追跡する
+/// @param detectedMulticlass 別に求めた物体検出の結果。nullptr の場合は検出を行うフレームでここで検出する
+void PorterSpotter::run(const cv::Mat &rgbImage, const double *timestamp,
+                        const std::vector<std::vector<BboxXyxy>> *detectedMulticlass, std::vector<TrackedBbox> &tracks,
+                        std::vector<BboxXyxy> &objectDetections)
+{
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    numRunFrames++;
+    if (isMotionGate)
+    {
+        // 動きがなく追跡中の人物もいなければ、前の結果を返して処理を飛ばす
+        if (!motionGate.HasMotion(rgbImage) && byte.GetNumTrackers() == 0)
+        {
+            tracks.clear();
+            objectDetections = lastObjectDetections;
+            numSkippedFrames++;
+            return;
+        }
+        motionGate.UpdateReference();
+    }
+
+    if (isDetectionFrame())
+    {
+        // 物体検出。Run() ではここで検出する。RunTracking() では別のスレッドの検出器と競合しないようここでは検出せず、
+        // 結果がない場合は人物も対象物もないものとする。推論に失敗した場合も同じ
+        if (detectedMulticlass == nullptr || detectedMulticlass->size() < 2)
+        {
+            multiclassDetections.clear();
+            if (detectedMulticlass == nullptr) detect(rgbImage, multiclassDetections);
+            if (multiclassDetections.size() < 2) multiclassDetections.resize(2);
+            detectedMulticlass = &multiclassDetections;
+        }
+
+        // 追跡
+        const std::vector<BboxXyxy> &personDetections = (*detectedMulticlass)[0];
+        if (timestamp != nullptr)
+        {
+            byte.Exec(personDetections, *timestamp, tracks);
+        }
+        else
+        {
+            byte.Exec(personDetections, tracks);
+        }
+        lastObjectDetections = (*detectedMulticlass)[1];
+        numFramesSinceDetection = 0;
+        if (isFlowPropagation) flowPropagator.SetReference(rgbImage, tracks);
+    }
+    else
+    {
+        // 検出を行わないフレームは予測だけで追跡する
+        if (timestamp != nullptr)
+        {
+            byte.Predict(*timestamp, tracks);
+        }
+        else
+        {
+            byte.Predict(tracks);
+        }
+        if (isFlowPropagation)
+        {
+            // フローで動かしたボックスでトラッカーを補正し、次の検出フレームの予測と割当にも使う
+            flowPropagator.Propagate(rgbImage, tracks, &isTrackPropagated);
+            for (size_t i = 0; i < tracks.size(); i++)
+            {
+                if (isTrackPropagated[i]) byte.Correct(tracks[i]);
+            }
+        }
+        numFramesSinceDetection++;
+    }
 
     // 姿勢推定
-    poseEstimator.Exec(rgbImage, tracks);
+    objectDetections = lastObjectDetections;
+    if (isProximityGatedPose)
+    {
+        // 対象物の近くにいる人物と、前のフレームで対象物を持っていた人物だけ推定する
+        // 推定しない人物の姿勢の履歴とキャッシュも消さずに残す
+        poseTargets.clear();
+        poseTargetIdcs.clear();
+        liveTrackIds.clear();
+        for (size_t i = 0; i < tracks.size(); i++)
+        {
+            liveTrackIds.push_back(tracks[i].id);
+            if (holdingTrackIds.count(tracks[i].id) > 0 || isNearObject(tracks[i].bodyBbox, objectDetections))
+            {
+                poseTargets.push_back(tracks[i]);
+                poseTargetIdcs.push_back(i);
+            }
+        }
+        estimatePoses(rgbImage, startTime, objectDetections, poseTargets, &liveTrackIds);
+        for (size_t k = 0; k < poseTargets.size(); k++)
+        {
+            TrackedBbox &track = tracks[poseTargetIdcs[k]];
+            track.poseKeypoints.swap(poseTargets[k].poseKeypoints);
+            track.isPoseRefreshed = poseTargets[k].isPoseRefreshed;
+        }
+    }
+    else
+    {
+        estimatePoses(rgbImage, startTime, objectDetections, tracks, nullptr);
+    }
 
     // 対象物を持っているかどうかの判定
-    objectDetections = multiclassDetections[1];
     checkObjectHolding(tracks, objectDetections);
+    holdingTrackIds.clear();
+    for (const TrackedBbox &track : tracks)
+    {
+        if (track.isHoldingObject) holdingTrackIds.insert(track.id);
+    }
 }
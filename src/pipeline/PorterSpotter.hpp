@@ -8,13 +8,18 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <string>
+#include <unordered_set>
 
+#include "ResourcePool.hpp"
 #include "object_detection/Yolov8.hpp"
+#include "pipeline/MotionGate.hpp"
 #include "pose_estimation/PoseEstimator.hpp"
 #include "tracking/Byte.hpp"
+#include "tracking/FlowPropagator.hpp"
 
 /// @brief 人物の体を検出し、追跡を行い、ポーズを推定し、時系列のポーズデータを解析し、転倒を検知するクラス
 class PorterSpotter
@@ -23,17 +28,114 @@ private:
     Yolov8 yolov8;
     Byte byte;
     PoseEstimator poseEstimator;
+    FlowPropagator flowPropagator;
+    MotionGate motionGate;
+
+    ResourcePool<Yolov8> *detectorPool; // 物体検出に使う共有のインスタンス。nullptr なら yolov8 で検出する
 
     bool isDetectionModelReady;
     bool isPoseEstimatorModelReady;
 
+    int detectionInterval;                              // 物体検出を行うフレームの間隔。1 なら毎フレーム
+    double uncertaintyLimit;                            // 位置の分散がこれを超えたら次のフレームで検出する。0 以下は無効
+    int numFramesSinceDetection;                        // 前に物体検出を行ってからのフレーム数。-1 なら次は必ず検出する
+    std::vector<BboxXyxy> lastObjectDetections;         // 前に物体検出を行ったフレームの対象物
+    bool isFlowPropagation;                             // 検出を行わないフレームでオプティカルフローを使う
+    std::vector<unsigned char> isTrackPropagated;       // オプティカルフローで動かしたトラック (作業領域)
+    bool isMotionGate;                                  // 動きのないフレームを飛ばす
+    int numRunFrames;                                   // Run() を呼んだフレーム数
+    int numSkippedFrames;                               // 動きがないため処理を飛ばしたフレーム数
+    bool isProximityGatedPose;                          // 対象物の近くにいる人物だけ姿勢推定する
+    std::unordered_set<unsigned int> holdingTrackIds;   // 前のフレームで対象物を持っていたトラック ID
+    std::vector<TrackedBbox> poseTargets;               // 姿勢推定する人物 (作業領域)
+    std::vector<size_t> poseTargetIdcs;                 // poseTargets の各人物の tracks 内の番号
+    std::vector<int> liveTrackIds;                      // 姿勢の履歴を残す全人物のトラック ID (作業領域)
+    double frameTimeBudget;                             // 1フレームの処理時間の予算 [秒]。0 以下なら制限しない
+    std::vector<unsigned char> isPoseTargetPrioritized; // 姿勢推定で優先する人物 (作業領域)
+
+    std::vector<std::vector<BboxXyxy>> multiclassDetections; // 物体検出の結果 (作業領域)
+
+    bool isDetectionFrame() const;
+    void detect(const cv::Mat &rgbImage, std::vector<std::vector<BboxXyxy>> &multiclassDetections);
+    void estimatePoses(const cv::Mat &rgbImage, const std::chrono::steady_clock::time_point startTime,
+                       const std::vector<BboxXyxy> &objectDetections, std::vector<TrackedBbox> &targets,
+                       const std::vector<int> *liveTrackIds);
+    void run(const cv::Mat &rgbImage, const double *timestamp,
+             const std::vector<std::vector<BboxXyxy>> *detectedMulticlass, std::vector<TrackedBbox> &tracks,
+             std::vector<BboxXyxy> &objectDetections);
+
 public:
     PorterSpotter();
     ~PorterSpotter();
 
+    /// @brief 物体検出ネットワークの入力サイズを指定する。InitializeDetection() の前に呼ぶ。両方 0 なら DLC のまま
+    bool SetDetectionInputSize(const int width, const int height) { return yolov8.SetInputSize(width, height); }
+    /// @brief 混雑したシーン向けに、空間的に絞り込んだ疎な割当で追跡する
+    void SetGatedAssociation(const bool isGatedAssociation) { byte.SetGatedAssociation(isGatedAssociation); }
+    /// @brief 物体検出を interval フレームに1回だけ行い、間のフレームはカルマンフィルタの予測だけで追跡する。
+    /// 間のフレームの対象物は前に検出した結果を使う。1 なら毎フレーム検出する。
+    /// 間のフレームは等速で外挿するので、次の検出では予測位置がずれて IoU の割当が外れやすく、ID が入れ替わりやすい。
+    /// 特に、1回しか検出されておらず速度が 0 のトラックと、間で向きを変えた人物で外れる。
+    /// また、トラックは検出されない時間で削除するので、続けて数回の検出に失敗すると ID が変わる (SetTrackMaxAge)
+    void SetDetectionInterval(const int interval) { detectionInterval = std::max(interval, 1); }
+    /// @brief 検出されない時間がこれを超えたトラックを削除する (Byte::SetMaxAge)。基準のフレーム間隔を 1 とする。
+    /// 間のフレームの時間も数えるので、検出の間隔を長くするほど検出に失敗してよい回数が減る
+    void SetTrackMaxAge(const int maxAge) { byte.SetMaxAge(maxAge); }
+    /// @brief 可視のトラックの位置の分散 (Byte::GetMaxPositionVariance) が limit を超えたら、間隔によらず次のフレームで
+    /// 物体検出を行う。0 以下なら間隔だけで決める
+    void SetUncertaintyLimit(const double limit) { uncertaintyLimit = limit; }
+    /// @brief 物体検出を行わないフレームで、人物のボックスを疎なオプティカルフローで前のフレームから動かす。
+    /// SetDetectionInterval() で間隔を 2 以上にしたときに使う。
+    /// 動かしたボックスでトラッカーを補正するので、向きを変えたり止まったりした人物も次の検出で同じ ID に割り当てやすい
+    void SetFlowPropagation(const bool isFlowPropagation) { this->isFlowPropagation = isFlowPropagation; }
+    /// @brief フレームの差分で動きがなく、追跡中のトラッカーもない場合は、物体検出・追跡・姿勢推定を行わない。
+    /// そのフレームの結果はトラックなし、対象物は前に検出した結果とする
+    /// @param activityThreshold 動きありとする変化した画素の割合 (MotionGate::SetActivityThreshold)
+    void SetMotionGate(const bool isMotionGate, const double activityThreshold = 0.002);
+    /// @brief 物体検出の後で人物のボックスと対象物の位置を比べ、対象物の近くにいる人物と、前のフレームで対象物を
+    /// 持っていた人物だけ姿勢推定する。対象物がないフレームでは姿勢推定を行わない。
+    /// 姿勢推定しなかった人物の poseKeypoints は空になる
+    void SetProximityGatedPose(const bool isProximityGatedPose) { this->isProximityGatedPose = isProximityGatedPose; }
+    /// @brief 止まっている人物の姿勢を推論せずに前の推論結果から作る (PoseEstimator::SetPoseCache)
+    void SetPoseCache(const bool isPoseCache) { poseEstimator.SetPoseCache(isPoseCache); }
+    /// @brief 1フレームの処理時間の予算 [秒]。姿勢推定を新しいトラック、対象物の近くにいるトラック、前の推定から
+    /// 時間が経ったトラックの順に行い、予算を超える分は先送りして前の推定結果を使う (PoseEstimator::Exec)。
+    /// 0 以下なら制限しない。
+    /// RunTracking() では呼んでからの時間で測り、別のスレッドで行った物体検出の時間は含まない
+    void SetFrameTimeBudget(const double seconds) { frameTimeBudget = seconds; }
+    int GetNumDeferredPoses() const { return poseEstimator.GetNumDeferredPoses(); }
+    int GetNumDroppedPoses() const { return poseEstimator.GetNumDroppedPoses(); }
+    int GetNumBudgetExceededFrames() const { return poseEstimator.GetNumBudgetExceededFrames(); }
+    int GetNumInferredPoses() const { return poseEstimator.GetNumInferredPoses(); }
+    int GetNumReusedPoses() const { return poseEstimator.GetNumReusedPoses(); }
+    int GetNumRunFrames() const { return numRunFrames; }
+    int GetNumSkippedFrames() const { return numSkippedFrames; }
+    /// @brief 物体検出と姿勢推定のネットワークを、複数の PorterSpotter で共有する pool から借りて使う。
+    /// 追跡や姿勢の履歴などの状態はこのインスタンスが持つ。pool のインスタンスはネットワークを構築しておき、
+    /// このインスタンスの InitializeDetection() と InitializePoseEstimator() は呼ばない
+    void SetModelPools(ResourcePool<Yolov8> *detectorPool, ResourcePool<PoseEstimator> *poseEstimatorPool);
     bool InitializeDetection(const uint8_t *buffer, const size_t size, const std::vector<std::string> &runtimes);
     bool InitializePoseEstimator(const uint8_t *buffer, const size_t size, const std::vector<std::string> &runtimes);
     void ResetTracker();
 
     void Run(const cv::Mat &rgbImage, std::vector<TrackedBbox> &tracks, std::vector<BboxXyxy> &objectDetections);
+    /// @brief フレームの時刻を与えて実行する。追跡の予測は前のフレームからの経過時間だけ進む
+    /// @param timestamp フレームの時刻 [秒]
+    void Run(const cv::Mat &rgbImage, const double timestamp, std::vector<TrackedBbox> &tracks,
+             std::vector<BboxXyxy> &objectDetections);
+
+    /// @brief パイプライン実行用に、物体検出だけを行う。追跡の状態には触れないので、RunTracking() と別のスレッドで呼べる。
+    /// 結果は必ず人物と対象物の2クラス分で、推論に失敗した場合はどちらも空になる。
+    /// SetModelPools() で detectorPool を指定しない場合はこのインスタンスの検出器を使うので、Run() と同時に呼ばない
+    void Detect(const cv::Mat &rgbImage, std::vector<std::vector<BboxXyxy>> &multiclassDetections);
+    /// @brief ResetTracker() の後 frameIndex 番目 (0 始まり) の RunTracking() で物体検出の結果を使う可能性があるかどうか。
+    /// 検出の間隔だけで決まる場合はそのフレームだけ、位置の分散や動きで決まる場合は全フレームで true
+    bool MayDetect(const int frameIndex) const;
+    /// @brief 別のスレッドで Detect() した結果を使って、追跡以降を Run() と同じように実行する。
+    /// MayDetect() が false のフレームの multiclassDetections は使わないので、空でよい。
+    /// このスレッドでは物体検出を行わず、検出を行うフレームで multiclassDetections が2クラス分ない場合は
+    /// 人物も対象物もないものとして追跡する
+    void RunTracking(const cv::Mat &rgbImage, const double timestamp,
+                     const std::vector<std::vector<BboxXyxy>> &multiclassDetections, std::vector<TrackedBbox> &tracks,
+                     std::vector<BboxXyxy> &objectDetections);
 };
@@ -0,0 +1,101 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/// @brief 1つの書き込みスレッドと1つの読み出しスレッドの間で使う、容量固定のロックフリーなリングバッファ。
+/// 書き込み位置は書き込みスレッドだけが、読み出し位置は読み出しスレッドだけが進める。
+/// 容量を超えて書き込もうとした場合と空のときに読み出そうとした場合は、Push() と Pop() が待つ。
+/// 待つ間はしばらく他のスレッドに譲り、長引いたら短く眠って、推論中のスレッドの CPU を奪わないようにする
+template <typename T>
+class SpscQueue
+{
+private:
+    std::vector<T> items;     // 満杯と空を区別するため、容量より1つ多く確保する
+    const size_t numSlots;
+    std::atomic<size_t> head; // 次に読み出す位置 (読み出しスレッドが進める)
+    std::atomic<size_t> tail; // 次に書き込む位置 (書き込みスレッドが進める)
+    std::atomic<bool> isClosed;
+
+    static void wait(int &numWaits)
+    {
+        if (++numWaits < 64)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+public:
+    explicit SpscQueue(const size_t capacity)
+        : items(capacity + 1), numSlots(capacity + 1), head(0), tail(0), isClosed(false)
+    {
+    }
+    ~SpscQueue(){};
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /// @brief 空きがあれば item を書き込む
+    /// @retval いっぱいなら false
+    bool TryPush(const T &item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t next = (t + 1) % numSlots;
+        if (next == head.load(std::memory_order_acquire)) return false;
+        items[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief 要素があれば item に読み出す
+    /// @retval 空なら false
+    bool TryPop(T &item)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h];
+        head.store((h + 1) % numSlots, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief 空きができるまで待って item を書き込む
+    void Push(const T &item)
+    {
+        int numWaits = 0;
+        while (!TryPush(item))
+        {
+            wait(numWaits);
+        }
+    }
+
+    /// @brief 要素が書き込まれるまで待って item に読み出す
+    /// @retval Close() の後で空なら false
+    bool Pop(T &item)
+    {
+        int numWaits = 0;
+        while (!TryPop(item))
+        {
+            // Close() の前に書き込まれた要素を読み残さないよう、閉じたことを確かめてからもう一度読む
+            if (isClosed.load(std::memory_order_acquire)) return TryPop(item);
+            wait(numWaits);
+        }
+        return true;
+    }
+
+    /// @brief これ以上書き込まないことを読み出し側に知らせる。書き込みスレッドから呼ぶ
+    void Close() { isClosed.store(true, std::memory_order_release); }
+};
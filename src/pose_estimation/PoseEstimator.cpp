@@ -10,36 +10,47 @@
 #include "PoseEstimator.hpp"
 #include "SNPE/SNPEBuilder.hpp"
 #include "SnpeUtil.hpp"
+#include "tracking/BboxUtil.hpp"
 
+#include <algorithm>
 #include <cmath>
 
-// TODO:適切な関数名に変える。NormalizeImageとか。
-void PoseEstimator::makeFloatImg(const cv::Mat &input, cv::Mat &output)
-{
-    cv::Mat convertedInput;
-    input.convertTo(convertedInput, CV_32FC3, 1.0 / 255.0);
-
-    const int h_img = input.rows;
-    const int w_img = input.cols;
-    cv::Mat mean(h_img, w_img, CV_32FC3, {0.485, 0.456, 0.406});
-    cv::Mat std(h_img, w_img, CV_32FC3, {0.229, 0.224, 0.225});
-    output = (convertedInput - mean) / std;
-}
+// 出力テンソル名
+static const std::string simccXTensorName = "simcc_x";
+static const std::string simccYTensorName = "simcc_y";
 
-// TODO: 役割をクロップとアフィン変換に分けた関数を作る。
-std::pair<cv::Mat, cv::Mat> PoseEstimator::cropImageByDetectBox(const cv::Mat &inputImage, const BboxXyxy &box)
-{
-    std::pair<cv::Mat, cv::Mat> resultPair;
+// 入力の正規化パラメータ (RGB の順)
+static const float normMean[3] = {0.485f, 0.456f, 0.406f};
+static const float normStd[3] = {0.229f, 0.224f, 0.225f};
 
-    if (!inputImage.data)
+/// @brief BGR のクロップ画像を RGB に並べ替え、(x / 255 - mean) / std で正規化して dst (HWC, float) に書き込む
+static void normalizeCrop(const cv::Mat &crop, float *dst)
+{
+    // (x / 255 - mean) / std = x * scale + bias
+    float scale[3];
+    float bias[3];
+    for (int c = 0; c < 3; c++)
     {
-        return resultPair;
+        scale[c] = 1.0f / (255.0f * normStd[c]);
+        bias[c] = -normMean[c] / normStd[c];
     }
 
-    // deep copy
-    cv::Mat inputMatCopy;
-    inputImage.copyTo(inputMatCopy);
+    for (int y = 0; y < crop.rows; y++)
+    {
+        const uchar *src = crop.ptr<uchar>(y);
+        float *out = dst + y * crop.cols * 3;
+        for (int x = 0; x < crop.cols; x++)
+        {
+            out[3 * x + 0] = (float)src[3 * x + 2] * scale[0] + bias[0];
+            out[3 * x + 1] = (float)src[3 * x + 1] * scale[1] + bias[1];
+            out[3 * x + 2] = (float)src[3 * x + 0] * scale[2] + bias[2];
+        }
+    }
+}
 
+// TODO: 役割をクロップとアフィン変換に分けた関数を作る。
+cv::Mat PoseEstimator::cropImageByDetectBox(const cv::Mat &inputImage, const BboxXyxy &box, cv::Mat &cropped) const
+{
     // calculate the width, height and center points of the human detection box
     float inputWidth = inputImage.cols;
     float inputHeight = inputImage.rows;
@@ -75,11 +86,10 @@ std::pair<cv::Mat, cv::Mat> PoseEstimator::cropImageByDetectBox(const cv::Mat &i
         GetAffineTransform(box_center_x, box_center_y, scale_image_width, scale_image_height, 192, 256, true);
 
     // affine transform
-    cv::Mat affine_image;
-    cv::warpAffine(inputMatCopy, affine_image, affine_transform, cv::Size(192, 256), cv::INTER_LINEAR);
-    resultPair = std::make_pair(affine_image, affine_transform_reverse);
+    // 入力画像は読み取るだけなのでコピーせずに直接変換する。cropped は同じサイズなら再確保されない
+    cv::warpAffine(inputImage, cropped, affine_transform, cv::Size(192, 256), cv::INTER_LINEAR);
 
-    return resultPair;
+    return affine_transform_reverse;
 }
 
 void PoseEstimator::decodeOutput(const zdl::DlSystem::TensorMap &tensorMap) const
@@ -128,12 +138,126 @@ void PoseEstimator::clearDisappearedTracks(const std::vector<int> &trackIds)
             ++it;
         }
     }
+    for (auto it = poseCacheByTrackId.begin(); it != poseCacheByTrackId.end();)
+    {
+        if (std::find(trackIds.begin(), trackIds.end(), it->first) == trackIds.end())
+        {
+            it = poseCacheByTrackId.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void PoseEstimator::SetPoseCache(const bool isPoseCache, const double minIou, const int maxAge, const double maxSpeed)
+{
+    this->isPoseCache = isPoseCache;
+    minCacheIou = minIou;
+    maxCacheAge = maxAge;
+    maxCacheSpeed = maxSpeed;
+    poseCacheByTrackId.clear();
+}
+
+/// @brief fromBox で推論した関節点を toBox に合わせて平行移動・拡大縮小する
+static void projectPose(const BboxXyxy &fromBox, const std::vector<PosePoint> &keypoints, const BboxXyxy &toBox,
+                        std::vector<PosePoint> &projected)
+{
+    const double scaleX = (toBox.x1 - toBox.x0) / (fromBox.x1 - fromBox.x0);
+    const double scaleY = (toBox.y1 - toBox.y0) / (fromBox.y1 - fromBox.y0);
+    projected = keypoints;
+    for (PosePoint &point : projected)
+    {
+        point.x = (float)(toBox.x0 + (point.x - fromBox.x0) * scaleX);
+        point.y = (float)(toBox.y0 + (point.y - fromBox.y0) * scaleY);
+    }
+}
+
+/// @brief トラックが止まっていれば、前に推論した関節点を今のボックスに合わせて posePoints に書き込む
+/// @retval 再利用できなければ false
+bool PoseEstimator::reuseCachedPose(const TrackedBbox &track, std::vector<PosePoint> &posePoints)
+{
+    const std::map<int, CachedPose>::iterator found = poseCacheByTrackId.find(track.id);
+    if (found == poseCacheByTrackId.end()) return false;
+    CachedPose &cached = found->second;
+    if (cached.age >= maxCacheAge) return false;
+
+    const BboxXyxy &box = track.bodyBbox;
+    const double speed = std::hypot(track.velocity[0], track.velocity[1]);
+    if (speed > maxCacheSpeed * (box.y1 - box.y0)) return false;
+    if (BboxUtil::CalcIou(cached.box, box) < minCacheIou) return false;
+
+    projectPose(cached.box, cached.keypoints, box, posePoints);
+    cached.age++;
+    return true;
+}
+
+/// @brief 姿勢推定を先送りしたトラックに、前に推論した関節点を今のボックスに合わせて書き込む
+/// @retval 前の推論結果がなければ false
+bool PoseEstimator::carryCachedPose(const TrackedBbox &track, std::vector<PosePoint> &posePoints)
+{
+    const std::map<int, CachedPose>::iterator found = poseCacheByTrackId.find(track.id);
+    if (found == poseCacheByTrackId.end()) return false;
+    projectPose(found->second.box, found->second.keypoints, track.bodyBbox, posePoints);
+    found->second.age++;
+    return true;
+}
+
+/// @brief 推論する人物の順番を決める。新しいトラック、優先するトラック、前の推論から時間が経ったトラックの順
+void PoseEstimator::sortByPriority(const std::vector<TrackedBbox> &tracks, const std::vector<unsigned char> &isPrioritized,
+                                   std::vector<size_t> &trackIdcs) const
+{
+    std::vector<int> ranks(tracks.size(), 0);
+    std::vector<int> ages(tracks.size(), 0);
+    for (const size_t i : trackIdcs)
+    {
+        const std::map<int, CachedPose>::const_iterator found = poseCacheByTrackId.find(tracks[i].id);
+        if (found == poseCacheByTrackId.end()) continue; // 新しいトラック
+        ranks[i] = isPrioritized[i] ? 1 : 2;
+        ages[i] = found->second.age;
+    }
+    std::stable_sort(trackIdcs.begin(), trackIdcs.end(), [&ranks, &ages](const size_t a, const size_t b) {
+        return ranks[a] != ranks[b] ? ranks[a] < ranks[b] : ages[a] > ages[b];
+    });
 }
 
-PoseEstimator::PoseEstimator() {}
+void PoseEstimator::storeCachedPose(const int trackId, const BboxXyxy &box, const std::vector<PosePoint> &posePoints)
+{
+    // 幅や高さが 0 のボックスからは写せないので覚えない
+    if (box.x1 <= box.x0 || box.y1 <= box.y0) return;
+    CachedPose &cached = poseCacheByTrackId[trackId];
+    cached.box = box;
+    cached.keypoints = posePoints;
+    cached.age = 0;
+}
+
+PoseEstimator::PoseEstimator()
+    : maxBatchSize(8), isNetworkReady(false), isUserBufferMode(true), networkPool(nullptr), isPoseCache(false),
+      minCacheIou(0.85), maxCacheSpeed(0.02), maxCacheAge(5), numInferredPoses(0), numReusedPoses(0),
+      numDeferredPoses(0), numDroppedPoses(0), numBudgetExceededFrames(0), secondsPerPose(0.0)
+{
+}
 
 PoseEstimator::~PoseEstimator() {}
 
+std::unique_ptr<zdl::SNPE::SNPE> PoseEstimator::buildNetwork(zdl::DlContainer::IDlContainer *container,
+                                                             const zdl::DlSystem::RuntimeList &runtimeList,
+                                                             const zdl::DlSystem::StringList &outputTensorNames,
+                                                             const zdl::DlSystem::TensorShapeMap *inputDimensions) const
+{
+    const zdl::DlSystem::PlatformConfig platformConfig;
+    zdl::SNPE::SNPEBuilder snpeBuilder(container);
+    snpeBuilder.setOutputTensors(outputTensorNames)
+        .setRuntimeProcessorOrder(runtimeList)
+        .setUseUserSuppliedBuffers(isUserBufferMode)
+        .setPlatformConfig(platformConfig)
+        .setInitCacheMode(false)
+        .setPerformanceProfile(zdl::DlSystem::PerformanceProfile_t::BALANCED);
+    if (inputDimensions != nullptr) snpeBuilder.setInputDimensions(*inputDimensions);
+    return snpeBuilder.build();
+}
+
 bool PoseEstimator::CreateNetwork(const uint8_t *buffer, const size_t size, const std::vector<std::string> &runtimes)
 {
     this->featureSize = featureSize;
@@ -162,16 +286,8 @@ bool PoseEstimator::CreateNetwork(const uint8_t *buffer, const size_t size, cons
     outputTensorNames.append("simcc_y");
 
     // Create SNPE object
-    const zdl::DlSystem::PlatformConfig platformConfig;
     std::unique_ptr<zdl::DlContainer::IDlContainer> container = SnpeUtil::loadContainerFromBuffer(buffer, size);
-    zdl::SNPE::SNPEBuilder snpeBuilder(container.get());
-    network = snpeBuilder.setOutputTensors(outputTensorNames)
-                  .setRuntimeProcessorOrder(runtimeList)
-                  .setUseUserSuppliedBuffers(false)
-                  .setPlatformConfig(platformConfig)
-                  .setInitCacheMode(false)
-                  .setPerformanceProfile(zdl::DlSystem::PerformanceProfile_t::BALANCED)
-                  .build();
+    network = buildNetwork(container.get(), runtimeList, outputTensorNames, nullptr);
 
     if (network == nullptr)
     {
@@ -180,133 +296,257 @@ bool PoseEstimator::CreateNetwork(const uint8_t *buffer, const size_t size, cons
         return false;
     }
 
+    if (!ioBuffers.Create(network, isUserBufferMode))
+    {
+        std::cerr << "Error while creating input/output buffers" << std::endl;
+        isNetworkReady = false;
+        return false;
+    }
+
+    // バッチ推論用のネットワーク。入力のバッチ次元を maxBatchSize に書き換えて構築する
+    batchNetwork.reset();
+    if (maxBatchSize > 1)
+    {
+        const std::vector<size_t> &inputDims = ioBuffers.InputDims(); // NHWC
+        const std::string inputName = (*network->getInputTensorNames()).at(0);
+        const zdl::DlSystem::TensorShape batchShape({(size_t)maxBatchSize, inputDims[1], inputDims[2], inputDims[3]});
+        zdl::DlSystem::TensorShapeMap inputDimensions;
+        inputDimensions.add(inputName.c_str(), batchShape);
+        batchNetwork = buildNetwork(container.get(), runtimeList, outputTensorNames, &inputDimensions);
+        if (batchNetwork == nullptr || !batchIoBuffers.Create(batchNetwork, isUserBufferMode))
+        {
+            // バッチ次元を変更できない DLC やランタイムでは、1人ずつ推論する
+            std::cerr << "Batched pose network is not available. Falling back to batch size 1" << std::endl;
+            batchNetwork.reset();
+        }
+    }
+
     isNetworkReady = true;
     return true;
 }
 
-std::vector<PosePoint> PoseEstimator::Inference(const cv::Mat &input_mat, const BboxXyxy &box)
+bool PoseEstimator::preprocess(const cv::Mat &inputImage, const BboxXyxy &box, float *inputData,
+                               cv::Mat &affineTransformReverse)
 {
-    std::vector<PosePoint> pose_result;
+    if (!inputImage.data) return false;
 
-    // 人物がCropされてアフィン変換やスケーリングがされた画像と、逆変換する変換マップのペアを作成
-    std::pair<cv::Mat, cv::Mat> crop_resultPair = cropImageByDetectBox(input_mat, box);
-    cv::Mat crop_mat = crop_resultPair.first;
-    cv::Mat affine_transform_reverse = crop_resultPair.second;
+    // 人物をCropしてアフィン変換やスケーリングをした画像と、逆変換する変換マップを作成
+    affineTransformReverse = cropImageByDetectBox(inputImage, box, cropImage);
 
-    // deep copy
-    cv::Mat crop_mat_copy;
-    crop_mat.copyTo(crop_mat_copy);
+    const std::vector<size_t> &inputDims = ioBuffers.InputDims();
+    if (cropImage.rows != (int)inputDims[1] || cropImage.cols != (int)inputDims[2])
+    {
+        std::cerr << "Size of image does not match network input." << std::endl;
+        return false;
+    }
 
-    // TODO: preprocess() で関数化
-    // BGR to RGB
-    cv::Mat input_mat_copy_rgb;
-    cv::cvtColor(crop_mat_copy, input_mat_copy_rgb, cv::COLOR_BGR2RGB);
+    // BGR to RGB と Standardization をまとめて行い、SNPE の入力 (HWC) に直接書き込む
+    normalizeCrop(cropImage, inputData);
+    return true;
+}
+
+void PoseEstimator::postprocess(const SnpeIoBuffers &buffers, const int batchIdx, const cv::Mat &affineTransformReverse,
+                                const int imageWidth, const int imageHeight, std::vector<PosePoint> &pose_result) const
+{
+    const std::vector<size_t> &simcc_x_dims = buffers.OutputDims(simccXTensorName);
+    const std::vector<size_t> &simcc_y_dims = buffers.OutputDims(simccYTensorName);
+
+    int joint_num = 0;
+    if (simcc_x_dims[1] == simcc_y_dims[1])
+    {
+        joint_num = simcc_x_dims[1]; // joint_num: 17
+    }
+
+    int extend_width = simcc_x_dims[2];  // extend_width: 384
+    int extend_height = simcc_y_dims[2]; // extend_width: 512
+
+    // バッチ内の batchIdx 番目の出力
+    const float *simcc_x_result = buffers.Output(simccXTensorName) + batchIdx * joint_num * extend_width;
+    const float *simcc_y_result = buffers.Output(simccYTensorName) + batchIdx * joint_num * extend_height;
+
+    // クロップ座標から元画像の座標への逆アフィン変換 (2x3, CV_64F)
+    float inverseAffine[6];
+    for (int i = 0; i < 6; i++)
+    {
+        inverseAffine[i] = (float)affineTransformReverse.at<double>(i / 3, i % 3);
+    }
+
+    simccDecoder.Decode(simcc_x_result, simcc_y_result, joint_num, extend_width, extend_height, inverseAffine,
+                        imageWidth, imageHeight, pose_result);
+}
 
-    // Standardization
-    cv::Mat input_mat_copy_rgb_std;
-    makeFloatImg(input_mat_copy_rgb, input_mat_copy_rgb_std);
+std::vector<PosePoint> PoseEstimator::Inference(const cv::Mat &input_mat, const BboxXyxy &box)
+{
+    std::vector<PosePoint> pose_result;
 
-    // image data, HWC->CHW, image_data - mean / std normalize
-    int image_channels = input_mat_copy_rgb_std.channels();
-    int image_height = input_mat_copy_rgb_std.rows;
-    int image_width = input_mat_copy_rgb_std.cols;
+    cv::Mat affine_transform_reverse;
+    if (!preprocess(input_mat, box, ioBuffers.Input(), affine_transform_reverse)) return pose_result;
 
     // inference
-    std::unique_ptr<zdl::DlSystem::ITensor> inputTensor = SnpeUtil::loadInputTensor(network, input_mat_copy_rgb_std);
-    zdl::DlSystem::TensorMap output_tensors;
-    if (!network->execute(inputTensor.get(), output_tensors))
+    if (!ioBuffers.Execute(network))
     {
         std::cerr << "Error while executing the network." << std::endl;
         return pose_result;
     }
 
-    // postprocess
-    // TODO: postprocess() で関数化
-    const std::string layerName_x = "simcc_x";
-    const std::string layerName_y = "simcc_y";
-    zdl::DlSystem::ITensor *simcc_x = output_tensors.getTensor(layerName_x.c_str());
-    zdl::DlSystem::ITensor *simcc_y = output_tensors.getTensor(layerName_y.c_str());
+    postprocess(ioBuffers, 0, affine_transform_reverse, input_mat.cols, input_mat.rows, pose_result);
+    return pose_result;
+}
 
-    zdl::DlSystem::TensorShape simcc_x_dims = simcc_x->getShape();
-    zdl::DlSystem::TensorShape simcc_y_dims = simcc_y->getShape();
+void PoseEstimator::inferBatch(const cv::Mat &input_image, const std::vector<BboxXyxy> &boxes, const size_t begin,
+                               const size_t end, std::vector<std::vector<PosePoint>> &results)
+{
+    const std::vector<size_t> &inputDims = batchIoBuffers.InputDims();
+    const size_t inputSize = inputDims[1] * inputDims[2] * inputDims[3];
 
-    int batch_size = 0;
-    if (simcc_x_dims[0] == simcc_y_dims[0])
+    // 各人物のクロップをバッチの各スロットに書き込む。使わないスロットは前回の値のまま推論する
+    affineTransformReverses.resize(end - begin);
+    std::vector<bool> isPrepared(end - begin, false);
+    for (size_t i = begin; i < end; i++)
     {
-        batch_size = simcc_x_dims[0]; // batch_size: 1
+        float *inputData = batchIoBuffers.Input() + (i - begin) * inputSize;
+        isPrepared[i - begin] = preprocess(input_image, boxes[i], inputData, affineTransformReverses[i - begin]);
     }
 
-    int joint_num = 0;
-    if (simcc_x_dims[1] == simcc_y_dims[1])
+    if (!batchIoBuffers.Execute(batchNetwork))
     {
-        joint_num = simcc_x_dims[1]; // joint_num: 17
+        std::cerr << "Error while executing the network." << std::endl;
+        return;
     }
 
-    int extend_width = simcc_x_dims[2];  // extend_width: 384
-    int extend_height = simcc_y_dims[2]; // extend_width: 512
-
-    auto ptrX = simcc_x->cbegin();
-    auto ptrY = simcc_y->cbegin();
-    const float *simcc_x_result = &(*ptrX);
-    const float *simcc_y_result = &(*ptrY);
-
-    for (int i = 0; i < joint_num; i++)
+    for (size_t i = begin; i < end; i++)
     {
-        // find the maximum and maximum indexes in the value of each Extend_width length
-        auto x_biggest_iter =
-            std::max_element(simcc_x_result + i * extend_width, simcc_x_result + i * extend_width + extend_width);
-        int max_x_pos = std::distance(simcc_x_result + i * extend_width, x_biggest_iter);
-        float pose_x = static_cast<float>(max_x_pos) / 2.0f;
-        float score_x = *x_biggest_iter;
-
-        // find the maximum and maximum indexes in the value of each exten_height length
-        auto y_biggest_iter =
-            std::max_element(simcc_y_result + i * extend_height, simcc_y_result + i * extend_height + extend_height);
-        int max_y_pos = std::distance(simcc_y_result + i * extend_height, y_biggest_iter);
-        float pose_y = static_cast<float>(max_y_pos) / 2.0f;
-        float score_y = *y_biggest_iter;
-
-        // float score = (score_x + score_y) / 2;
-        float score = std::max(score_x, score_y);
-
-        PosePoint temp_point;
-        temp_point.x = pose_x;
-        temp_point.y = pose_y;
-        temp_point.score = score;
-        pose_result.emplace_back(temp_point);
+        if (!isPrepared[i - begin]) continue;
+        postprocess(batchIoBuffers, (int)(i - begin), affineTransformReverses[i - begin], input_image.cols,
+                    input_image.rows, results[i]);
     }
+}
 
-    // anti affine transformation to obtain the coordinates on the original picture
-    for (int i = 0; i < pose_result.size(); ++i)
-    {
-        cv::Mat origin_point_Mat = cv::Mat::ones(3, 1, CV_64FC1);
-        origin_point_Mat.at<double>(0, 0) = pose_result[i].x;
-        origin_point_Mat.at<double>(1, 0) = pose_result[i].y;
+void PoseEstimator::InferenceBatch(const cv::Mat &input_image, const std::vector<BboxXyxy> &boxes,
+                                   std::vector<std::vector<PosePoint>> &results)
+{
+    results.assign(boxes.size(), std::vector<PosePoint>());
 
-        cv::Mat temp_result_mat = affine_transform_reverse * origin_point_Mat;
+    size_t begin = 0;
+    while (begin < boxes.size())
+    {
+        const size_t numRemaining = boxes.size() - begin;
+        const size_t chunkSize = std::min(numRemaining, (size_t)maxBatchSize);
 
-        pose_result[i].x = temp_result_mat.at<double>(0, 0);
-        pose_result[i].y = temp_result_mat.at<double>(1, 0);
+        // バッチの半分以上が埋まるときだけバッチ推論する。少ない人数では空きスロットの計算が無駄になるので1人ずつ推論する
+        if (batchNetwork != nullptr && 2 * chunkSize > (size_t)maxBatchSize)
+        {
+            inferBatch(input_image, boxes, begin, begin + chunkSize, results);
+            begin += chunkSize;
+        }
+        else
+        {
+            results[begin] = Inference(input_image, boxes[begin]);
+            begin++;
+        }
     }
+}
 
-    // Normalize scale points in image with size of image to (0-1)
-    for (int i = 0; i < pose_result.size(); ++i)
+void PoseEstimator::inferPoses(const cv::Mat &input_image, const std::vector<BboxXyxy> &boxes,
+                               std::vector<std::vector<PosePoint>> &results)
+{
+    if (networkPool == nullptr)
     {
-        pose_result[i].x = pose_result[i].x / input_mat.cols;
-        pose_result[i].y = pose_result[i].y / input_mat.rows;
+        InferenceBatch(input_image, boxes, results);
+        return;
     }
+    ResourcePool<PoseEstimator>::Lease network(*networkPool);
+    network->InferenceBatch(input_image, boxes, results);
+}
 
-    return pose_result;
+void PoseEstimator::Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks,
+                         const std::vector<int> *liveTrackIds)
+{
+    exec(input_image, tracks, nullptr, nullptr, liveTrackIds);
+}
+
+void PoseEstimator::Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks,
+                         const std::vector<unsigned char> &isPrioritized,
+                         const std::chrono::steady_clock::time_point deadline, const std::vector<int> *liveTrackIds)
+{
+    exec(input_image, tracks, &isPrioritized, &deadline, liveTrackIds);
 }
 
-void PoseEstimator::Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks)
+/// @param isPrioritized 優先するトラック。deadline と共に nullptr なら全員を推論する
+/// @param deadline 推論を始めてよい期限。nullptr なら期限なし
+/// @param liveTrackIds 履歴とキャッシュを残すトラック。nullptr なら tracks のトラック
+void PoseEstimator::exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks,
+                         const std::vector<unsigned char> *isPrioritized,
+                         const std::chrono::steady_clock::time_point *deadline, const std::vector<int> *liveTrackIds)
 {
     std::vector<int> trackIds;
-    for (TrackedBbox &track : tracks)
+    std::vector<size_t> candidateIdcs; // 推論が必要なトラックの番号
+    std::vector<std::vector<PosePoint>> posePointsList(tracks.size());
+    for (size_t i = 0; i < tracks.size(); i++)
     {
+        TrackedBbox &track = tracks[i];
         trackIds.push_back(track.id);
-        std::vector<PosePoint> posePoints;
-        posePoints = Inference(input_image, track.bodyBbox);
+        track.isPoseRefreshed = false;
+        if (isPoseCache && reuseCachedPose(track, posePointsList[i]))
+        {
+            numReusedPoses++;
+            continue;
+        }
+        candidateIdcs.push_back(i);
+    }
+    if (deadline != nullptr) sortByPriority(tracks, *isPrioritized, candidateIdcs);
+
+    // バッチ1回分ずつ推論し、期限までに終わらない見込みになったら残りを先送りする
+    const size_t chunkSize = batchNetwork != nullptr || networkPool != nullptr ? (size_t)maxBatchSize : 1;
+    size_t numInferred = 0;
+    std::vector<BboxXyxy> boxes;
+    std::vector<std::vector<PosePoint>> inferredPosePointsList;
+    while (numInferred < candidateIdcs.size())
+    {
+        const size_t end = std::min(numInferred + chunkSize, candidateIdcs.size());
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (deadline != nullptr)
+        {
+            const std::chrono::duration<double> expected(secondsPerPose * (end - numInferred));
+            if (start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(expected) > *deadline) break;
+        }
+
+        boxes.clear();
+        for (size_t k = numInferred; k < end; k++)
+        {
+            boxes.push_back(tracks[candidateIdcs[k]].bodyBbox);
+        }
+        inferPoses(input_image, boxes, inferredPosePointsList);
+        for (size_t k = numInferred; k < end; k++)
+        {
+            const size_t i = candidateIdcs[k];
+            posePointsList[i].swap(inferredPosePointsList[k - numInferred]);
+            if (posePointsList[i].empty()) continue;
+            storeCachedPose(tracks[i].id, tracks[i].bodyBbox, posePointsList[i]);
+            tracks[i].isPoseRefreshed = true;
+        }
+
+        // 1人あたりの推論時間の移動平均
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double seconds = elapsed.count() / (end - numInferred);
+        secondsPerPose = secondsPerPose > 0.0 ? 0.8 * secondsPerPose + 0.2 * seconds : seconds;
+        numInferred = end;
+    }
+    numInferredPoses += (int)numInferred;
+
+    // 先送りしたトラックは前の推論結果を使う
+    if (numInferred < candidateIdcs.size()) numBudgetExceededFrames++;
+    for (size_t k = numInferred; k < candidateIdcs.size(); k++)
+    {
+        const size_t i = candidateIdcs[k];
+        numDeferredPoses++;
+        if (!carryCachedPose(tracks[i], posePointsList[i])) numDroppedPoses++;
+    }
+
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        TrackedBbox &track = tracks[i];
+        const std::vector<PosePoint> &posePoints = posePointsList[i];
         if (!posePoints.empty())
         {
             std::vector<PosePoint> poseKeypoints_removed;
@@ -316,7 +556,7 @@ void PoseEstimator::Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &t
         }
     }
 
-    clearDisappearedTracks(trackIds);
+    clearDisappearedTracks(liveTrackIds != nullptr ? *liveTrackIds : trackIds);
 
     for (const auto &pair : sequentialPoseKeypointsByTrackId)
     {
@@ -8,10 +8,17 @@
  */
 #pragma once
 
+#include "DlContainer/IDlContainer.hpp"
 #include "DlSystem/RuntimeList.hpp"
+#include "DlSystem/StringList.hpp"
+#include "DlSystem/TensorShapeMap.hpp"
+#include "ResourcePool.hpp"
 #include "SNPE/SNPE.hpp"
+#include "SnpeIoBuffers.hpp"
 #include "Types.hpp"
 #include "pose_estimation/PoseUtils.hpp"
+#include "pose_estimation/SimccDecoder.hpp"
+#include <chrono>
 #include <opencv2/opencv.hpp>
 
 using SequentialPoseKeypoints = std::deque<std::vector<PosePoint>>;
@@ -21,24 +28,116 @@ class PoseEstimator
 {
 private:
     unsigned int featureSize;
+    int maxBatchSize; // バッチ推論で一度に処理する人数
 
     bool isNetworkReady;
-    std::unique_ptr<zdl::SNPE::SNPE> network;
+    bool isUserBufferMode; // 入出力にユーザーバッファを使うかどうか
+    std::unique_ptr<zdl::SNPE::SNPE> network;      // バッチサイズ 1
+    SnpeIoBuffers ioBuffers;                       // 推論ごとに使い回す入出力バッファ
+    std::unique_ptr<zdl::SNPE::SNPE> batchNetwork; // バッチサイズ maxBatchSize。構築できなければ nullptr
+    SnpeIoBuffers batchIoBuffers;
+    std::vector<cv::Mat> affineTransformReverses; // バッチ内の各人物の逆アフィン変換
+    SimccDecoder simccDecoder;
+    ResourcePool<PoseEstimator> *networkPool; // 推論に使う共有のインスタンス。nullptr なら自身のネットワークで推論する
 
-    static void makeFloatImg(const cv::Mat &input, cv::Mat &output);
+    cv::Mat cropImage; // 人物のクロップ画像 (CV_8UC3)。推論ごとに使い回す
 
-    std::pair<cv::Mat, cv::Mat> cropImageByDetectBox(const cv::Mat &input_image, const BboxXyxy &box);
+    /// @brief トラックごとに最後に推論した姿勢
+    struct CachedPose
+    {
+        BboxXyxy box;                     // 推論したときの人物のボックス
+        std::vector<PosePoint> keypoints; // 推論結果
+        int age;                          // 推論してから前の結果を使ったフレーム数
+    };
+    bool isPoseCache;
+    double minCacheIou;   // 再利用するのに必要な、推論したときのボックスとの IoU
+    double maxCacheSpeed; // 再利用するトラックの速度の上限。ボックスの高さに対する1フレームあたりの移動量
+    int maxCacheAge;      // 続けて再利用するフレーム数の上限
+    std::map<int, CachedPose> poseCacheByTrackId;
+    int numInferredPoses;        // Exec() で推論した人数
+    int numReusedPoses;          // Exec() で前の推論結果を再利用した人数
+    int numDeferredPoses;        // 期限を過ぎたため推論を先送りした人数
+    int numDroppedPoses;         // 先送りした人物のうち、前の推論結果もなかった人数
+    int numBudgetExceededFrames; // 推論を先送りしたフレーム数
+    double secondsPerPose;       // 1人あたりの推論時間の移動平均 [秒]
+
+    /// @brief 人物の領域をネットワーク入力サイズにアフィン変換して cropped に書き込み、逆変換の行列を返す
+    cv::Mat cropImageByDetectBox(const cv::Mat &input_image, const BboxXyxy &box, cv::Mat &cropped) const;
+
+    std::unique_ptr<zdl::SNPE::SNPE> buildNetwork(zdl::DlContainer::IDlContainer *container,
+                                                  const zdl::DlSystem::RuntimeList &runtimeList,
+                                                  const zdl::DlSystem::StringList &outputTensorNames,
+                                                  const zdl::DlSystem::TensorShapeMap *inputDimensions) const;
+
+    /// @brief 人物をクロップして正規化し、inputData (ネットワーク入力1人分) に書き込む
+    bool preprocess(const cv::Mat &inputImage, const BboxXyxy &box, float *inputData, cv::Mat &affineTransformReverse);
+    /// @brief バッチ内の batchIdx 番目の SimCC 出力をデコードし、入力画像で正規化した座標に変換する
+    void postprocess(const SnpeIoBuffers &buffers, const int batchIdx, const cv::Mat &affineTransformReverse,
+                     const int imageWidth, const int imageHeight, std::vector<PosePoint> &pose_result) const;
+    void inferBatch(const cv::Mat &input_image, const std::vector<BboxXyxy> &boxes, const size_t begin,
+                    const size_t end, std::vector<std::vector<PosePoint>> &results);
 
     void decodeOutput(const zdl::DlSystem::TensorMap &tensorMap) const;
     void addPoseKeypoints(const int trackId, const std::vector<PosePoint> &poseKeypoints);
     void clearDisappearedTracks(const std::vector<int> &tracks);
+    bool reuseCachedPose(const TrackedBbox &track, std::vector<PosePoint> &posePoints);
+    bool carryCachedPose(const TrackedBbox &track, std::vector<PosePoint> &posePoints);
+    void storeCachedPose(const int trackId, const BboxXyxy &box, const std::vector<PosePoint> &posePoints);
+    void sortByPriority(const std::vector<TrackedBbox> &tracks, const std::vector<unsigned char> &isPrioritized,
+                        std::vector<size_t> &trackIdcs) const;
+    void inferPoses(const cv::Mat &input_image, const std::vector<BboxXyxy> &boxes,
+                    std::vector<std::vector<PosePoint>> &results);
+    void exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks,
+              const std::vector<unsigned char> *isPrioritized, const std::chrono::steady_clock::time_point *deadline,
+              const std::vector<int> *liveTrackIds);
 
 public:
     std::map<int, SequentialPoseKeypoints> sequentialPoseKeypointsByTrackId;
     PoseEstimator();
     ~PoseEstimator();
 
+    /// @brief ユーザーバッファモードを切り替える。CreateNetwork() の前に呼ぶ。
+    void SetUserBufferMode(const bool isUserBufferMode) { this->isUserBufferMode = isUserBufferMode; }
+
+    /// @brief デコードする関節のインデックス (COCO の 17 点) を指定する。空なら全関節。
+    /// デコードしない関節はスコア 0 になる。例えば物体の保持判定だけなら手首と肩だけで足りる。
+    void SetDecodedJoints(const std::vector<int> &jointIndices) { simccDecoder.SetJoints(jointIndices); }
+    /// @brief SimCC の argmax を放物線補間でサブピクセル精度にする (デフォルトはオフ)
+    void SetSubpixelRefinement(const bool isOn) { simccDecoder.SetSubpixelRefinement(isOn); }
+
+    /// @brief バッチ推論の最大人数を設定する。CreateNetwork() の前に呼ぶ。1 ならバッチ推論しない
+    void SetMaxBatchSize(const int maxBatchSize) { this->maxBatchSize = std::max(maxBatchSize, 1); }
+
+    /// @brief Exec() で、止まっている人物の姿勢を推論せずにトラック ID ごとの前の推論結果から作る。
+    /// 速度が小さく、推論したときのボックスとの IoU が minIou 以上なら、前の関節点を今のボックスに合わせて
+    /// 平行移動・拡大縮小して使う。maxAge フレーム続けて再利用したら推論し直す
+    /// @param maxSpeed ボックスの高さに対する1フレームあたりの移動量 (TrackedBbox::velocity) の上限
+    void SetPoseCache(const bool isPoseCache, const double minIou = 0.85, const int maxAge = 5,
+                      const double maxSpeed = 0.02);
+    int GetNumInferredPoses() const { return numInferredPoses; }
+    int GetNumReusedPoses() const { return numReusedPoses; }
+    int GetNumDeferredPoses() const { return numDeferredPoses; }
+    int GetNumDroppedPoses() const { return numDroppedPoses; }
+    int GetNumBudgetExceededFrames() const { return numBudgetExceededFrames; }
+
+    /// @brief 推論を pool から借りたインスタンスの InferenceBatch() で行う。姿勢の履歴やキャッシュは自身が持つので、
+    /// 複数の映像でネットワークを共有できる。pool のインスタンスは CreateNetwork() しておく
+    void SetNetworkPool(ResourcePool<PoseEstimator> *pool) { networkPool = pool; }
+
     bool CreateNetwork(const uint8_t *buffer, const size_t size, const std::vector<std::string> &runtimes);
     std::vector<PosePoint> Inference(const cv::Mat &input_mat, const BboxXyxy &box);
-    void Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks);
+    /// @brief 複数人の姿勢をまとめて推論する。maxBatchSize 人ずつ1回の execute で処理し、結果は Inference() と一致する
+    void InferenceBatch(const cv::Mat &input_image, const std::vector<BboxXyxy> &boxes,
+                        std::vector<std::vector<PosePoint>> &results);
+    /// @param liveTrackIds 一部の人物だけを推定するときに、姿勢の履歴とキャッシュを残すトラックの ID (tracks 以外も含む)。
+    /// nullptr なら tracks に無いトラックの履歴とキャッシュを消す
+    void Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks,
+              const std::vector<int> *liveTrackIds = nullptr);
+    /// @brief 期限のある姿勢推定。新しいトラック、isPrioritized のトラック、前の推論から時間が経ったトラックの順に
+    /// バッチ1回分ずつ推論し、次のバッチが deadline までに終わらない見込みになったら残りを先送りする。
+    /// 先送りしたトラックは前の推論結果を今のボックスに合わせて使う。推論したトラックは isPoseRefreshed が true になる
+    /// @param isPrioritized tracks と同じ長さ。対象物の近くにいるなど優先するトラックを 1 とする
+    /// @param liveTrackIds 1つ目の Exec() と同じ
+    void Exec(const cv::Mat &input_image, std::vector<TrackedBbox> &tracks, const std::vector<unsigned char> &isPrioritized,
+              const std::chrono::steady_clock::time_point deadline, const std::vector<int> *liveTrackIds = nullptr);
 };
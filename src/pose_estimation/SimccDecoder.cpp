@@ -0,0 +1,67 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "SimccDecoder.hpp"
+#include "SimdUtil.hpp"
+
+#include <algorithm>
+
+/// @brief argmax の前後の値を通る放物線の頂点から、サブピクセル位置のオフセット [-0.5, 0.5] を求める
+float SimccDecoder::refine(const float *simcc, const int length, const int maxPos) const
+{
+    if (maxPos <= 0 || maxPos >= length - 1) return 0.0f;
+
+    const float left = simcc[maxPos - 1];
+    const float center = simcc[maxPos];
+    const float right = simcc[maxPos + 1];
+    const float curvature = left - 2.0f * center + right;
+    if (curvature >= 0.0f) return 0.0f;
+
+    const float offset = 0.5f * (left - right) / curvature;
+    return std::min(std::max(offset, -0.5f), 0.5f);
+}
+
+void SimccDecoder::Decode(const float *simccX, const float *simccY, const int numJoints, const int lengthX,
+                          const int lengthY, const float inverseAffine[6], const int imageWidth, const int imageHeight,
+                          std::vector<PosePoint> &keypoints) const
+{
+    keypoints.assign(numJoints, PosePoint());
+
+    const int numDecoded = jointIndices.empty() ? numJoints : (int)jointIndices.size();
+    for (int k = 0; k < numDecoded; k++)
+    {
+        const int joint = jointIndices.empty() ? k : jointIndices[k];
+        if (joint < 0 || joint >= numJoints) continue;
+
+        const float *rowX = simccX + joint * lengthX;
+        const float *rowY = simccY + joint * lengthY;
+        float scoreX;
+        float scoreY;
+        const int maxX = SimdUtil::ArgMax(rowX, lengthX, scoreX);
+        const int maxY = SimdUtil::ArgMax(rowY, lengthY, scoreY);
+
+        float posX = (float)maxX;
+        float posY = (float)maxY;
+        if (isSubpixelRefinementOn)
+        {
+            posX += refine(rowX, lengthX, maxX);
+            posY += refine(rowY, lengthY, maxY);
+        }
+
+        // クロップ画像のピクセル座標
+        const float cropX = posX / splitRatio;
+        const float cropY = posY / splitRatio;
+
+        // 逆アフィン変換で元画像のピクセル座標に戻し、[0, 1] に正規化する
+        PosePoint &keypoint = keypoints[joint];
+        keypoint.x = (inverseAffine[0] * cropX + inverseAffine[1] * cropY + inverseAffine[2]) / (float)imageWidth;
+        keypoint.y = (inverseAffine[3] * cropX + inverseAffine[4] * cropY + inverseAffine[5]) / (float)imageHeight;
+        keypoint.score = std::max(scoreX, scoreY);
+    }
+}
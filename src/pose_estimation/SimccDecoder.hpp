@@ -0,0 +1,48 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "pose_estimation/PoseUtils.hpp"
+
+/// @brief RTMPose の SimCC 出力をキーポイントにデコードする。
+/// 各関節の x, y の分布の argmax を SIMD で求め、クロップ座標から元画像の座標へ float の 2x3 逆アフィン変換で戻す。
+/// 一部の関節だけをデコードでき、デコードしない関節は PosePoint() (スコア 0) になる。
+class SimccDecoder
+{
+private:
+    float splitRatio;              // SimCC の分布の解像度 / 入力画像の解像度
+    bool isSubpixelRefinementOn;   // argmax の前後の値から放物線補間でサブピクセル位置を推定する
+    std::vector<int> jointIndices; // デコードする関節。空なら全関節
+
+    float refine(const float *simcc, const int length, const int maxPos) const;
+
+public:
+    SimccDecoder() : splitRatio(2.0f), isSubpixelRefinementOn(false){};
+    ~SimccDecoder(){};
+
+    /// @brief デコードする関節のインデックスを指定する。空なら全関節をデコードする
+    void SetJoints(const std::vector<int> &jointIndices) { this->jointIndices = jointIndices; }
+    void SetSubpixelRefinement(const bool isSubpixelRefinementOn)
+    {
+        this->isSubpixelRefinementOn = isSubpixelRefinementOn;
+    }
+
+    /// @brief 1人分の SimCC 出力をデコードする
+    /// @param simccX numJoints x lengthX の x 方向の分布
+    /// @param simccY numJoints x lengthY の y 方向の分布
+    /// @param inverseAffine クロップ座標から元画像のピクセル座標への 2x3 アフィン変換 (行優先)
+    /// @param imageWidth, imageHeight 元画像のサイズ。キーポイントはこのサイズで [0, 1] に正規化する
+    /// @param keypoints numJoints 個のキーポイント
+    void Decode(const float *simccX, const float *simccY, const int numJoints, const int lengthX, const int lengthY,
+                const float inverseAffine[6], const int imageWidth, const int imageHeight,
+                std::vector<PosePoint> &keypoints) const;
+};
@@ -8,9 +8,22 @@
  */
 
 #include "BboxUtil.hpp"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// x86-64 では AVX2 の関数を target 属性で別にコンパイルし、実行時に CPU が対応していれば使う
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BBOX_UTIL_AVX2_DISPATCH
+#endif
+
 /// @brief コーナーフォーマットのバウンディングボックスをUVSRフォーマットに変換する
 BboxUvsr BboxUtil::Xyxy2Uvsr(const BboxXyxy input)
 {
@@ -43,3 +56,314 @@ BboxXyxy BboxUtil::Uvsr2Xyxy(const BboxUvsr input)
 
     return ret;
 }
+
+/// @brief 2つのコーナーフォーマットのバウンディングボックスのIoUを計算する
+double BboxUtil::CalcIou(const BboxXyxy &b1, const BboxXyxy &b2)
+{
+    const double overlapX1 = std::max(b1.x0, b2.x0);
+    const double overlapY1 = std::max(b1.y0, b2.y0);
+    const double overlapX2 = std::min(b1.x1, b2.x1);
+    const double overlapY2 = std::min(b1.y1, b2.y1);
+
+    const double overlapArea = std::max(0., overlapX2 - overlapX1) * std::max(0., overlapY2 - overlapY1);
+    const double unionArea = ((b1.x1 - b1.x0) * (b1.y1 - b1.y0) + (b2.x1 - b2.x0) * (b2.y1 - b2.y0) - overlapArea);
+
+    const double iou = overlapArea / unionArea;
+    return iou;
+}
+
+void BboxUtil::ToArray(const std::vector<BboxXyxy> &bboxes, BboxArray<double> &array)
+{
+    array.Clear();
+    for (const BboxXyxy &b : bboxes)
+    {
+        array.PushBack(b.x0, b.y0, b.x1, b.y1);
+    }
+}
+
+// 一括 IoU 計算のカーネル。各カーネルは begin から処理できるだけ処理し、処理を終えた位置を返す。
+// max と min は std::max(a, b) が (a < b) ? b : a を返すのに合わせて引数の順序を選び、nan や -0 を含めて CalcIou と一致させる。
+
+static int calcIousScalar(const double x0, const double y0, const double x1, const double y1, const double area,
+                          const BboxArray<double> &boxes, const int begin, double *ious)
+{
+    const int n = boxes.Size();
+    for (int j = begin; j < n; j++)
+    {
+        const double overlapX1 = std::max(boxes.x0s[j], x0);
+        const double overlapY1 = std::max(boxes.y0s[j], y0);
+        const double overlapX2 = std::min(boxes.x1s[j], x1);
+        const double overlapY2 = std::min(boxes.y1s[j], y1);
+        const double overlapArea = std::max(0., overlapX2 - overlapX1) * std::max(0., overlapY2 - overlapY1);
+        ious[j] = overlapArea / (boxes.areas[j] + area - overlapArea);
+    }
+    return n;
+}
+
+#if defined(__SSE2__)
+static int calcIousSse2(const double x0, const double y0, const double x1, const double y1, const double area,
+                        const BboxArray<double> &boxes, const int begin, double *ious)
+{
+    const int n = boxes.Size();
+    const __m128d vx0 = _mm_set1_pd(x0);
+    const __m128d vy0 = _mm_set1_pd(y0);
+    const __m128d vx1 = _mm_set1_pd(x1);
+    const __m128d vy1 = _mm_set1_pd(y1);
+    const __m128d varea = _mm_set1_pd(area);
+    const __m128d zero = _mm_setzero_pd();
+    int j = begin;
+    for (; j + 2 <= n; j += 2)
+    {
+        // _mm_max_pd(a, b) は (a > b) ? a : b、_mm_min_pd(a, b) は (a < b) ? a : b
+        const __m128d overlapX1 = _mm_max_pd(vx0, _mm_loadu_pd(&boxes.x0s[j]));
+        const __m128d overlapY1 = _mm_max_pd(vy0, _mm_loadu_pd(&boxes.y0s[j]));
+        const __m128d overlapX2 = _mm_min_pd(vx1, _mm_loadu_pd(&boxes.x1s[j]));
+        const __m128d overlapY2 = _mm_min_pd(vy1, _mm_loadu_pd(&boxes.y1s[j]));
+        const __m128d overlapArea = _mm_mul_pd(_mm_max_pd(_mm_sub_pd(overlapX2, overlapX1), zero),
+                                               _mm_max_pd(_mm_sub_pd(overlapY2, overlapY1), zero));
+        const __m128d unionArea = _mm_sub_pd(_mm_add_pd(_mm_loadu_pd(&boxes.areas[j]), varea), overlapArea);
+        _mm_storeu_pd(ious + j, _mm_div_pd(overlapArea, unionArea));
+    }
+    return j;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static int calcIousNeon(const double x0, const double y0, const double x1, const double y1, const double area,
+                        const BboxArray<double> &boxes, const int begin, double *ious)
+{
+    const int n = boxes.Size();
+    const float64x2_t vx0 = vdupq_n_f64(x0);
+    const float64x2_t vy0 = vdupq_n_f64(y0);
+    const float64x2_t vx1 = vdupq_n_f64(x1);
+    const float64x2_t vy1 = vdupq_n_f64(y1);
+    const float64x2_t varea = vdupq_n_f64(area);
+    const float64x2_t zero = vdupq_n_f64(0.0);
+    // vmaxq_f64 は nan を伝播するので、比較と選択で std::max と同じ結果にする
+    const auto maxOf = [](const float64x2_t a, const float64x2_t b) { return vbslq_f64(vcgtq_f64(a, b), a, b); };
+    const auto minOf = [](const float64x2_t a, const float64x2_t b) { return vbslq_f64(vcltq_f64(a, b), a, b); };
+    int j = begin;
+    for (; j + 2 <= n; j += 2)
+    {
+        const float64x2_t overlapX1 = maxOf(vx0, vld1q_f64(&boxes.x0s[j]));
+        const float64x2_t overlapY1 = maxOf(vy0, vld1q_f64(&boxes.y0s[j]));
+        const float64x2_t overlapX2 = minOf(vx1, vld1q_f64(&boxes.x1s[j]));
+        const float64x2_t overlapY2 = minOf(vy1, vld1q_f64(&boxes.y1s[j]));
+        const float64x2_t overlapArea =
+            vmulq_f64(maxOf(vsubq_f64(overlapX2, overlapX1), zero), maxOf(vsubq_f64(overlapY2, overlapY1), zero));
+        const float64x2_t unionArea = vsubq_f64(vaddq_f64(vld1q_f64(&boxes.areas[j]), varea), overlapArea);
+        vst1q_f64(ious + j, vdivq_f64(overlapArea, unionArea));
+    }
+    return j;
+}
+#endif
+
+#if defined(BBOX_UTIL_AVX2_DISPATCH)
+__attribute__((target("avx2"))) static int calcIousAvx2(const double x0, const double y0, const double x1,
+                                                        const double y1, const double area,
+                                                        const BboxArray<double> &boxes, const int begin, double *ious)
+{
+    const int n = boxes.Size();
+    const __m256d vx0 = _mm256_set1_pd(x0);
+    const __m256d vy0 = _mm256_set1_pd(y0);
+    const __m256d vx1 = _mm256_set1_pd(x1);
+    const __m256d vy1 = _mm256_set1_pd(y1);
+    const __m256d varea = _mm256_set1_pd(area);
+    const __m256d zero = _mm256_setzero_pd();
+    int j = begin;
+    for (; j + 4 <= n; j += 4)
+    {
+        const __m256d overlapX1 = _mm256_max_pd(vx0, _mm256_loadu_pd(&boxes.x0s[j]));
+        const __m256d overlapY1 = _mm256_max_pd(vy0, _mm256_loadu_pd(&boxes.y0s[j]));
+        const __m256d overlapX2 = _mm256_min_pd(vx1, _mm256_loadu_pd(&boxes.x1s[j]));
+        const __m256d overlapY2 = _mm256_min_pd(vy1, _mm256_loadu_pd(&boxes.y1s[j]));
+        const __m256d overlapArea = _mm256_mul_pd(_mm256_max_pd(_mm256_sub_pd(overlapX2, overlapX1), zero),
+                                                  _mm256_max_pd(_mm256_sub_pd(overlapY2, overlapY1), zero));
+        const __m256d unionArea = _mm256_sub_pd(_mm256_add_pd(_mm256_loadu_pd(&boxes.areas[j]), varea), overlapArea);
+        _mm256_storeu_pd(ious + j, _mm256_div_pd(overlapArea, unionArea));
+    }
+    return j;
+}
+
+static bool hasAvx2()
+{
+    static const bool isSupported = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return isSupported;
+}
+#endif
+
+static void calcIous(const double x0, const double y0, const double x1, const double y1,
+                     const BboxArray<double> &boxes, double *ious)
+{
+    const double area = (x1 - x0) * (y1 - y0);
+    int j = 0;
+#if defined(BBOX_UTIL_AVX2_DISPATCH)
+    if (hasAvx2()) j = calcIousAvx2(x0, y0, x1, y1, area, boxes, j, ious);
+#endif
+#if defined(__SSE2__)
+    j = calcIousSse2(x0, y0, x1, y1, area, boxes, j, ious);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    j = calcIousNeon(x0, y0, x1, y1, area, boxes, j, ious);
+#endif
+    calcIousScalar(x0, y0, x1, y1, area, boxes, j, ious);
+}
+
+void BboxUtil::CalcIous(const BboxXyxy &box, const BboxArray<double> &boxes, double *ious)
+{
+    calcIous(box.x0, box.y0, box.x1, box.y1, boxes, ious);
+}
+
+void BboxUtil::CalcIouMatrix(const BboxArray<double> &rows, const BboxArray<double> &cols, double *ious)
+{
+    const int numCols = cols.Size();
+    for (int i = 0; i < rows.Size(); i++)
+    {
+        calcIous(rows.x0s[i], rows.y0s[i], rows.x1s[i], rows.y1s[i], cols, ious + (size_t)i * numCols);
+    }
+}
+
+// NMS の抑制判定のカーネル。見つかればその番号を返す。見つからなければ -1 を返し、j を処理を終えた位置に進める。
+// 比較の順序は BatchedNms の元のスカラー判定 (box が後から来た候補、boxes が残した候補) に合わせる。
+
+static int findIouAboveScalar(const float x0, const float y0, const float x1, const float y1, const float area,
+                              const BboxArray<float> &boxes, const float iouThreshold, int &j)
+{
+    for (; j < boxes.Size(); j++)
+    {
+        const float w = std::min(x1, boxes.x1s[j]) - std::max(x0, boxes.x0s[j]);
+        const float h = std::min(y1, boxes.y1s[j]) - std::max(y0, boxes.y0s[j]);
+        if (w <= 0.0f || h <= 0.0f)
+        {
+            if (0.0f > iouThreshold) return j;
+            continue;
+        }
+        const float inter = w * h;
+        const float unionArea = area + boxes.areas[j] - inter;
+        if (unionArea <= 0.0f)
+        {
+            if (0.0f > iouThreshold) return j;
+            continue;
+        }
+        if (inter > iouThreshold * unionArea) return j;
+    }
+    return -1;
+}
+
+#if defined(__SSE2__)
+static int findIouAboveSse2(const float x0, const float y0, const float x1, const float y1, const float area,
+                            const BboxArray<float> &boxes, const float iouThreshold, int &j)
+{
+    const int n = boxes.Size();
+    const __m128 vx0 = _mm_set1_ps(x0);
+    const __m128 vy0 = _mm_set1_ps(y0);
+    const __m128 vx1 = _mm_set1_ps(x1);
+    const __m128 vy1 = _mm_set1_ps(y1);
+    const __m128 varea = _mm_set1_ps(area);
+    const __m128 vt = _mm_set1_ps(iouThreshold);
+    const __m128 zero = _mm_setzero_ps();
+    // 重なりのない組は閾値が負のときだけ抑制する
+    const __m128 disjointHit = 0.0f > iouThreshold ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+    for (; j + 4 <= n; j += 4)
+    {
+        const __m128 w = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(&boxes.x1s[j]), vx1),
+                                    _mm_max_ps(_mm_loadu_ps(&boxes.x0s[j]), vx0));
+        const __m128 h = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(&boxes.y1s[j]), vy1),
+                                    _mm_max_ps(_mm_loadu_ps(&boxes.y0s[j]), vy0));
+        const __m128 inter = _mm_mul_ps(w, h);
+        const __m128 unionArea = _mm_sub_ps(_mm_add_ps(varea, _mm_loadu_ps(&boxes.areas[j])), inter);
+        // !(x <= 0) で判定し、nan の扱いをスカラーと合わせる
+        const __m128 isOverlapped = _mm_and_ps(_mm_and_ps(_mm_cmpnle_ps(w, zero), _mm_cmpnle_ps(h, zero)),
+                                               _mm_cmpnle_ps(unionArea, zero));
+        const __m128 hit = _mm_or_ps(_mm_and_ps(isOverlapped, _mm_cmpgt_ps(inter, _mm_mul_ps(vt, unionArea))),
+                                     _mm_andnot_ps(isOverlapped, disjointHit));
+        const int mask = _mm_movemask_ps(hit);
+        if (mask != 0) return j + __builtin_ctz(mask);
+    }
+    return -1;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static int findIouAboveNeon(const float x0, const float y0, const float x1, const float y1, const float area,
+                            const BboxArray<float> &boxes, const float iouThreshold, int &j)
+{
+    const int n = boxes.Size();
+    const float32x4_t vx0 = vdupq_n_f32(x0);
+    const float32x4_t vy0 = vdupq_n_f32(y0);
+    const float32x4_t vx1 = vdupq_n_f32(x1);
+    const float32x4_t vy1 = vdupq_n_f32(y1);
+    const float32x4_t varea = vdupq_n_f32(area);
+    const float32x4_t vt = vdupq_n_f32(iouThreshold);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const uint32x4_t disjointHit = vdupq_n_u32(0.0f > iouThreshold ? 0xffffffffu : 0u);
+    const auto maxOf = [](const float32x4_t a, const float32x4_t b) { return vbslq_f32(vcgtq_f32(a, b), a, b); };
+    const auto minOf = [](const float32x4_t a, const float32x4_t b) { return vbslq_f32(vcltq_f32(a, b), a, b); };
+    for (; j + 4 <= n; j += 4)
+    {
+        const float32x4_t w = vsubq_f32(minOf(vld1q_f32(&boxes.x1s[j]), vx1), maxOf(vld1q_f32(&boxes.x0s[j]), vx0));
+        const float32x4_t h = vsubq_f32(minOf(vld1q_f32(&boxes.y1s[j]), vy1), maxOf(vld1q_f32(&boxes.y0s[j]), vy0));
+        const float32x4_t inter = vmulq_f32(w, h);
+        const float32x4_t unionArea = vsubq_f32(vaddq_f32(varea, vld1q_f32(&boxes.areas[j])), inter);
+        const uint32x4_t isOverlapped = vmvnq_u32(
+            vorrq_u32(vorrq_u32(vcleq_f32(w, zero), vcleq_f32(h, zero)), vcleq_f32(unionArea, zero)));
+        const uint32x4_t hit = vorrq_u32(vandq_u32(isOverlapped, vcgtq_f32(inter, vmulq_f32(vt, unionArea))),
+                                         vbicq_u32(disjointHit, isOverlapped));
+        if (vmaxvq_u32(hit) == 0) continue;
+        return findIouAboveScalar(x0, y0, x1, y1, area, boxes, iouThreshold, j);
+    }
+    return -1;
+}
+#endif
+
+#if defined(BBOX_UTIL_AVX2_DISPATCH)
+__attribute__((target("avx2"))) static int findIouAboveAvx2(const float x0, const float y0, const float x1,
+                                                            const float y1, const float area,
+                                                            const BboxArray<float> &boxes, const float iouThreshold,
+                                                            int &j)
+{
+    const int n = boxes.Size();
+    const __m256 vx0 = _mm256_set1_ps(x0);
+    const __m256 vy0 = _mm256_set1_ps(y0);
+    const __m256 vx1 = _mm256_set1_ps(x1);
+    const __m256 vy1 = _mm256_set1_ps(y1);
+    const __m256 varea = _mm256_set1_ps(area);
+    const __m256 vt = _mm256_set1_ps(iouThreshold);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 disjointHit = 0.0f > iouThreshold ? _mm256_castsi256_ps(_mm256_set1_epi32(-1)) : zero;
+    for (; j + 8 <= n; j += 8)
+    {
+        const __m256 w = _mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(&boxes.x1s[j]), vx1),
+                                       _mm256_max_ps(_mm256_loadu_ps(&boxes.x0s[j]), vx0));
+        const __m256 h = _mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(&boxes.y1s[j]), vy1),
+                                       _mm256_max_ps(_mm256_loadu_ps(&boxes.y0s[j]), vy0));
+        const __m256 inter = _mm256_mul_ps(w, h);
+        const __m256 unionArea = _mm256_sub_ps(_mm256_add_ps(varea, _mm256_loadu_ps(&boxes.areas[j])), inter);
+        const __m256 isOverlapped =
+            _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_NLE_UQ), _mm256_cmp_ps(h, zero, _CMP_NLE_UQ)),
+                          _mm256_cmp_ps(unionArea, zero, _CMP_NLE_UQ));
+        const __m256 hit =
+            _mm256_or_ps(_mm256_and_ps(isOverlapped, _mm256_cmp_ps(inter, _mm256_mul_ps(vt, unionArea), _CMP_GT_OQ)),
+                         _mm256_andnot_ps(isOverlapped, disjointHit));
+        const int mask = _mm256_movemask_ps(hit);
+        if (mask != 0) return j + __builtin_ctz(mask);
+    }
+    return -1;
+}
+#endif
+
+int BboxUtil::FindIouAbove(const float x0, const float y0, const float x1, const float y1, const float area,
+                           const BboxArray<float> &boxes, const float iouThreshold)
+{
+    int j = 0;
+    int found = -1;
+#if defined(BBOX_UTIL_AVX2_DISPATCH)
+    if (hasAvx2()) found = findIouAboveAvx2(x0, y0, x1, y1, area, boxes, iouThreshold, j);
+    if (found >= 0) return found;
+#endif
+#if defined(__SSE2__)
+    found = findIouAboveSse2(x0, y0, x1, y1, area, boxes, iouThreshold, j);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    found = findIouAboveNeon(x0, y0, x1, y1, area, boxes, iouThreshold, j);
+#endif
+    if (found >= 0) return found;
+    return findIouAboveScalar(x0, y0, x1, y1, area, boxes, iouThreshold, j);
+}
@@ -8,11 +8,67 @@
  */
 #pragma once
 
+#include <vector>
+
 #include "Types.hpp"
 
+/// @brief 座標と面積を要素ごとの配列に並べたバウンディングボックスの集合 (structure of arrays)。
+/// BboxUtil の一括 IoU 計算の入力に使う。面積は (x1 - x0) * (y1 - y0) とする
+template <typename T>
+struct BboxArray
+{
+    std::vector<T> x0s;
+    std::vector<T> y0s;
+    std::vector<T> x1s;
+    std::vector<T> y1s;
+    std::vector<T> areas;
+
+    int Size() const { return (int)x0s.size(); }
+
+    void Clear()
+    {
+        x0s.clear();
+        y0s.clear();
+        x1s.clear();
+        y1s.clear();
+        areas.clear();
+    }
+
+    void PushBack(const T x0, const T y0, const T x1, const T y1)
+    {
+        x0s.push_back(x0);
+        y0s.push_back(y0);
+        x1s.push_back(x1);
+        y1s.push_back(y1);
+        areas.push_back((x1 - x0) * (y1 - y0));
+    }
+};
+
 /// @brief Bboxに関連するユーティリティ関数を提供します。
 namespace BboxUtil
 {
     BboxUvsr Xyxy2Uvsr(const BboxXyxy input);
     BboxXyxy Uvsr2Xyxy(const BboxUvsr input);
+    double CalcIou(const BboxXyxy &b1, const BboxXyxy &b2);
+
+    /// @brief BboxXyxy の配列を BboxArray に詰め直す
+    void ToArray(const std::vector<BboxXyxy> &bboxes, BboxArray<double> &array);
+
+    // 以下の一括計算は x86-64 では SSE2 を基本とし、実行時に AVX2 が使えればそちらを使う。aarch64 では NEON を使う。
+    // どの経路でも CalcIou() と同じ順序で演算するので、結果はスカラーの計算とビット単位で一致する (KernelBenchmark で確かめる)。
+
+    /// @brief 1つのボックスと複数のボックスの IoU をまとめて計算する。ious[j] = CalcIou(boxes[j], box)
+    /// @param[out] ious boxes.Size() 個の IoU
+    void CalcIous(const BboxXyxy &box, const BboxArray<double> &boxes, double *ious);
+
+    /// @brief 2つのボックスの集合の全ての組の IoU を計算する。ious[i * cols.Size() + j] = CalcIou(cols[j], rows[i])
+    /// @param[out] ious 行優先で並べた rows.Size() x cols.Size() の IoU
+    void CalcIouMatrix(const BboxArray<double> &rows, const BboxArray<double> &cols, double *ious);
+
+    /// @brief IoU が閾値を超える最初のボックスを探す (NMS の抑制判定)。除算を使わずに inter > iouThreshold * union で判定する。
+    /// 重なりのないボックスの IoU は 0 とする
+    /// @param area box の面積
+    /// @retval 見つかったボックスの番号。見つからない場合は -1
+    int FindIouAbove(const float x0, const float y0, const float x1, const float y1, const float area,
+                     const BboxArray<float> &boxes, const float iouThreshold);
 }
@@ -10,19 +10,7 @@
 #include "Byte.hpp"
 #include "MathUtil.hpp"
 
-double Byte::calcIou(const BboxXyxy b1, const BboxXyxy b2)
-{
-    const double overlapX1 = std::max(b1.x0, b2.x0);
-    const double overlapY1 = std::max(b1.y0, b2.y0);
-    const double overlapX2 = std::min(b1.x1, b2.x1);
-    const double overlapY2 = std::min(b1.y1, b2.y1);
-
-    const double overlapArea = std::max(0., overlapX2 - overlapX1) * std::max(0., overlapY2 - overlapY1);
-    const double unionArea = ((b1.x1 - b1.x0) * (b1.y1 - b1.y0) + (b2.x1 - b2.x0) * (b2.y1 - b2.y0) - overlapArea);
-
-    const double iou = overlapArea / unionArea;
-    return iou;
-}
+#include <algorithm>
 
 /// @brief iouBiggerFlg行列から、割当が一意にきまるかどうかを判定
 /// @param iouBiggerFlg IOU行列のうちiouThresholdより大きい要素には1、小さい要素には0が格納された行列
@@ -56,8 +44,7 @@ bool Byte::isMatchedUniquely(const cv::Mat iouBiggerFlg)
 /// @brief trackersのbboxを取得
 void Byte::getBboxesXyxy(const ObjectTracker &tracker, BboxXyxy &xyxy) const
 {
-    const BboxUvsr uvsr = tracker.GetBbox();
-    xyxy = BboxUtil::Uvsr2Xyxy(uvsr);
+    xyxy = tracker.GetXyxy();
     xyxy.x0 = MathUtil::Clamp<double>(xyxy.x0, 0.0, 1.0);
     xyxy.y0 = MathUtil::Clamp<double>(xyxy.y0, 0.0, 1.0);
     xyxy.x1 = MathUtil::Clamp<double>(xyxy.x1, 0.0, 1.0);
@@ -68,7 +55,7 @@ void Byte::getBboxesXyxy(const ObjectTracker &tracker, BboxXyxy &xyxy) const
 /// @brief IOU行列から適切な割当indexを作成する関数
 /// @param iouMatrix IOU行列
 /// @param iouThreshold
-void Byte::makeMatchedIdcs(const cv::Mat iouMatrix, std::list<RowCol> &associations, const double iouThreshold) const
+void Byte::makeMatchedIdcs(const cv::Mat iouMatrix, std::vector<RowCol> &associations, const double iouThreshold)
 {
     // 以下マッチングの作成
 
@@ -95,53 +82,55 @@ void Byte::makeMatchedIdcs(const cv::Mat iouMatrix, std::list<RowCol> &associati
     }
     else
     {
-        // 線形割当(Hungarian Algorithm)
-        LinearSumAssignment lsa(iouMatrix * (-1));
-        lsa.ComputeAssociation(associations);
-        // matchedIndexLisの要素のうち、iouThreshold未満のものは削除
-        for (auto itr_a = associations.begin(); itr_a != associations.end();)
+        // 線形割当。IOUの符号を反転したものをコストとする (nan は重なりなしとして扱う)
+        costMatrix.resize((size_t)iouMatrix.rows * iouMatrix.cols);
+        for (int j = 0; j < iouMatrix.rows; j++)
         {
-            if (iouMatrix.at<double>(itr_a->row, itr_a->col) < iouThreshold)
+            for (int i = 0; i < iouMatrix.cols; i++)
             {
-                itr_a = associations.erase(itr_a);
-            }
-            else
-            {
-                itr_a++;
+                const double iou = iouMatrix.at<double>(j, i);
+                costMatrix[(size_t)j * iouMatrix.cols + i] = (iou > 0.0) ? -iou : 0.0;
             }
         }
+        lsa.Solve(costMatrix.data(), iouMatrix.rows, iouMatrix.cols, associations);
+        // 割当のうち、iouThreshold未満のものは削除
+        associations.erase(std::remove_if(associations.begin(), associations.end(),
+                                          [&iouMatrix, iouThreshold](const RowCol &a) {
+                                              return iouMatrix.at<double>(a.row, a.col) < iouThreshold;
+                                          }),
+                           associations.end());
     }
 }
 
 /// @brief 検出結果とトラッキングデータの割当
 void Byte::associateDetectionsToTrackers(const std::vector<BboxXyxy> &detections,
                                          const std::vector<BboxXyxy> &trackedBboxesXyxy, const double iouThreshold,
-                                         std::list<RowCol> &associations, std::vector<int> &unmatchedDetectionIdcs) const
+                                         std::vector<RowCol> &associations, std::vector<int> &unmatchedDetectionIdcs)
 {
-    // IOU行列を計算
-    cv::Mat iouMatrix = calcIouMatrix(detections, trackedBboxesXyxy);
-    if (std::min(detections.size(), trackedBboxesXyxy.size()) > 0)
+    if (isGatedAssociation && iouThreshold > 0.0)
+    {
+        gatedAssociation.Associate(detections, trackedBboxesXyxy, iouThreshold, associations);
+    }
+    else if (std::min(detections.size(), trackedBboxesXyxy.size()) > 0)
     {
+        // IOU行列を計算
+        const cv::Mat iouMatrix = calcIouMatrix(detections, trackedBboxesXyxy);
         makeMatchedIdcs(iouMatrix, associations, iouThreshold);
     }
     else
     {
-        associations = {};
+        associations.clear();
     }
 
     // 検出結果(detectionBboxVec)の中からマッチングしていないものをunmatchedHighDetectionIdcsに格納
+    isDetectionMatched.assign(detections.size(), 0);
+    for (const RowCol &matchedIndex : associations)
+    {
+        isDetectionMatched[matchedIndex.row] = 1;
+    }
     for (int d_i = 0; d_i < (int)detections.size(); d_i++)
     {
-        bool isMatched = false;
-        for (const RowCol &matchedIndex : associations)
-        {
-            if (matchedIndex.row == d_i)
-            {
-                isMatched = true;
-                break;
-            }
-        }
-        if (!isMatched)
+        if (!isDetectionMatched[d_i])
         {
             unmatchedDetectionIdcs.push_back(d_i);
         }
@@ -151,46 +140,68 @@ void Byte::associateDetectionsToTrackers(const std::vector<BboxXyxy> &detections
 }
 
 /// @brief 検出結果のリストとトラッキングデータのリストからIOUの行列を作成する関数
-cv::Mat Byte::calcIouMatrix(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackedBboxesXyxy)
+cv::Mat Byte::calcIouMatrix(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackers)
 {
-    cv::Mat iouMatrix((int)detections.size(), (int)trackedBboxesXyxy.size(), CV_64F);
-    for (int i = 0; i < (int)detections.size(); i++)
-    {
-        for (int j = 0; j < (int)trackedBboxesXyxy.size(); j++)
-        {
-            iouMatrix.at<double>(i, j) = calcIou(trackedBboxesXyxy[j], detections[i]);
-        }
-    }
+    cv::Mat iouMatrix((int)detections.size(), (int)trackers.size(), CV_64F);
+    BboxUtil::ToArray(detections, detectionArray);
+    BboxUtil::ToArray(trackers, trackerArray);
+    BboxUtil::CalcIouMatrix(detectionArray, trackerArray, iouMatrix.ptr<double>(0));
     return iouMatrix;
 }
 
-/// @brief 使用済みデータのクリア。リストのクリアと、maxAge以上のトラッキングデータの削除。
+/// @brief 使用済みデータのクリア。maxAge以上のトラッキングデータを削除する。
 void Byte::cleanTrackers()
 {
-    for (auto trackrtItr = trackers.begin(); trackrtItr != trackers.end();)
+    size_t numActive = 0;
+    for (const int slot : activeSlots)
     {
-        if (trackrtItr->NumFrameDropped() > maxAge)
+        if (trackers[slot].TimeDropped() > maxAge)
         {
-            trackrtItr = trackers.erase(trackrtItr);
+            states.Release(slot);
         }
         else
         {
-            trackrtItr++;
+            activeSlots[numActive++] = slot;
         }
     }
+    activeSlots.resize(numActive);
+}
+
+/// @brief 検出結果から新しいトラッカーを作り、空いているスロットに置く
+void Byte::addTracker(const BboxXyxy &detection)
+{
+    const ObjectTracker tracker(states, BboxUtil::Xyxy2Uvsr(detection), numInitialFrame, minFrameSustained, currId,
+                                detection.confidence);
+    currId++;
+    const int slot = tracker.GetSlot();
+    if (slot >= (int)trackers.size()) trackers.resize(slot + 1);
+    trackers[slot] = tracker;
+    activeSlots.push_back(slot);
+}
+
+/// @brief スロット番号の順にtrackersのbboxを取得
+void Byte::getBboxesXyxy(const std::vector<int> &slots, std::vector<BboxXyxy> &xyxys) const
+{
+    xyxys.resize(slots.size());
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        getBboxesXyxy(trackers[slots[i]], xyxys[i]);
+    }
 }
 
 Byte::Byte()
-    : currFrame(0), currId(1), maxAge(5), numInitialFrame(3), minFrameSustained(3), iouThresholdHigh(0.3),
-      iouThresholdLow(0.3), confidenceThreshold(0.35), isSortOn(false)
+    : currFrame(0), currId(1), frameInterval(0.2), lastTimestamp(0.0), hasLastTimestamp(false), maxAge(5),
+      numInitialFrame(3), minFrameSustained(3), iouThresholdHigh(0.3), iouThresholdLow(0.3), confidenceThreshold(0.35),
+      isSortOn(false), isGatedAssociation(false), correctionNoiseScale(2.0)
 {
 }
 
 Byte::Byte(const int maxAge, const int numInitialFrame, const int minFrameSustained, const double iouThresholdHigh,
            const double iouThresholdLow, const double confidenceThreshold, const bool isSortOn)
-    : currFrame(0), currId(1), maxAge(maxAge), numInitialFrame(numInitialFrame), minFrameSustained(minFrameSustained),
-      iouThresholdHigh(iouThresholdHigh), iouThresholdLow(iouThresholdLow), confidenceThreshold(confidenceThreshold),
-      isSortOn(isSortOn)
+    : currFrame(0), currId(1), frameInterval(0.2), lastTimestamp(0.0), hasLastTimestamp(false), maxAge(maxAge),
+      numInitialFrame(numInitialFrame), minFrameSustained(minFrameSustained), iouThresholdHigh(iouThresholdHigh),
+      iouThresholdLow(iouThresholdLow), confidenceThreshold(confidenceThreshold), isSortOn(isSortOn),
+      isGatedAssociation(false), correctionNoiseScale(2.0)
 {
 }
 
@@ -212,29 +223,115 @@ void Byte::Reset()
 {
     currFrame = 0;
     currId = 1;
+    hasLastTimestamp = false;
     trackers.clear();
+    activeSlots.clear();
+    states.Clear();
 }
 
 void Byte::Exec(const std::vector<BboxXyxy> &detections, std::vector<TrackedBbox> &visibleTracks)
+{
+    exec(detections, 1.0, visibleTracks);
+}
+
+void Byte::Exec(const std::vector<BboxXyxy> &detections, const double timestamp,
+                std::vector<TrackedBbox> &visibleTracks)
+{
+    exec(detections, elapsedFrames(timestamp), visibleTracks);
+}
+
+void Byte::Predict(std::vector<TrackedBbox> &visibleTracks) { predict(1.0, visibleTracks); }
+
+void Byte::Predict(const double timestamp, std::vector<TrackedBbox> &visibleTracks)
+{
+    predict(elapsedFrames(timestamp), visibleTracks);
+}
+
+bool Byte::Correct(TrackedBbox &track)
+{
+    for (const int slot : activeSlots)
+    {
+        ObjectTracker &tracker = trackers[slot];
+        if (tracker.GetId() != (int)track.id || !states.IsFinite(slot)) continue;
+        tracker.Correct(BboxUtil::Xyxy2Uvsr(track.bodyBbox), correctionNoiseScale);
+        track.velocity = tracker.GetVelocity();
+        return true;
+    }
+    return false;
+}
+
+double Byte::GetMaxPositionVariance() const
+{
+    double maxVariance = 0.0;
+    for (const int slot : activeSlots)
+    {
+        if (trackers[slot].IsVisibleSoFar())
+        {
+            maxVariance = std::max(maxVariance, trackers[slot].GetPositionVariance());
+        }
+    }
+    return maxVariance;
+}
+
+/// @brief 前のフレームからの経過時間を基準のフレーム間隔を 1 として求め、時刻を記録する
+double Byte::elapsedFrames(const double timestamp)
+{
+    // 最初のフレームは基準の間隔とする。時刻が戻った場合は予測を進めない
+    double dt = 1.0;
+    if (hasLastTimestamp)
+    {
+        dt = std::max(timestamp - lastTimestamp, 0.0) / frameInterval;
+    }
+    lastTimestamp = timestamp;
+    hasLastTimestamp = true;
+    return dt;
+}
+
+/// @brief 予測だけでトラッカーを dt だけ進める。検出できていない時間は進め、maxAge はこの時間も含めて判定する。
+/// 検出されなかったフレーム数と連続検出のフレーム数は変えない
+void Byte::predict(const double dt, std::vector<TrackedBbox> &visibleTracks)
+{
+    states.PredictAll(dt);
+
+    // 前の Exec で更新されたトラッカーは、検出間隔が maxAge より長くても次の Exec まで返す。
+    // nan になったトラッカーは次の Exec で取り除く
+    for (const int slot : activeSlots)
+    {
+        ObjectTracker &tracker = trackers[slot];
+        tracker.AdvanceTime(dt);
+        const bool isAlive = tracker.IsUpdated() || tracker.TimeDropped() <= maxAge;
+        if (tracker.IsVisibleSoFar() && isAlive && states.IsFinite(slot))
+        {
+            BboxXyxy bodyXyxy;
+            getBboxesXyxy(tracker, bodyXyxy);
+            const TrackedBbox t(tracker.GetId(), bodyXyxy, tracker.GetVelocity());
+            visibleTracks.push_back(t);
+        }
+    }
+}
+
+/// @param dt 基準のフレーム間隔を 1 とした前のフレームからの経過時間
+void Byte::exec(const std::vector<BboxXyxy> &detections, const double dt, std::vector<TrackedBbox> &visibleTracks)
 {
     currFrame += 1;
 
-    // Trackerを現フレームの状態に更新する
-    for (auto trackerItr = trackers.begin(); trackerItr != trackers.end();)
+    // Trackerを現フレームの状態に更新する。カルマンフィルタの予測は全トラッカー分をまとめて行う
+    states.PredictAll(dt);
+    size_t numActive = 0;
+    for (const int slot : activeSlots)
     {
-        trackerItr->Predict();
-        const BboxUvsr uvsr = trackerItr->GetBbox();
-        const BboxXyxy xyxy = BboxUtil::Uvsr2Xyxy(uvsr);
-        if (std::isnan(xyxy.x0) || std::isnan(xyxy.y0) || std::isnan(xyxy.x1) || std::isnan(xyxy.y1))
+        trackers[slot].AdvanceFrame(dt);
+        if (states.IsFinite(slot))
         {
-            // 結果がnanなものは取り除く
-            trackerItr = trackers.erase(trackerItr);
+            activeSlots[numActive++] = slot;
         }
         else
         {
-            trackerItr++;
+            // 結果がnanなものは取り除く
+            states.Release(slot);
         }
     }
+    activeSlots.resize(numActive);
 
     std::vector<BboxXyxy> highConfidenceDetections;
     std::vector<BboxXyxy> lowConfidenceDetections;
@@ -261,15 +358,10 @@ void Byte::Exec(const std::vector<BboxXyxy> &detections, std::vector<TrackedBbox
     }
 
     // First association between all trackers and detections with high confidence
-    std::list<RowCol> highAssociations;          // matched index of first association
+    std::vector<RowCol> highAssociations;        // matched index of first association
     std::vector<int> unmatchedHighDetectionIdcs; // unmatched detections' ids after first association
     std::vector<BboxXyxy> trackedBboxesXyxy;
-    for (const ObjectTracker &tracker : trackers)
-    {
-        BboxXyxy xyxy;
-        getBboxesXyxy(tracker, xyxy);
-        trackedBboxesXyxy.push_back(xyxy);
-    }
+    getBboxesXyxy(activeSlots, trackedBboxesXyxy);
     associateDetectionsToTrackers(highConfidenceDetections, trackedBboxesXyxy, iouThresholdHigh, highAssociations,
                                   unmatchedHighDetectionIdcs);
 
@@ -277,38 +369,32 @@ void Byte::Exec(const std::vector<BboxXyxy> &detections, std::vector<TrackedBbox
     for (const RowCol &matchedIndex : highAssociations)
     {
         const BboxUvsr detectionUvsr = BboxUtil::Xyxy2Uvsr(highConfidenceDetections[matchedIndex.row]);
-        auto trackerItr = trackers.begin();
-        std::advance(trackerItr, matchedIndex.col);
-        trackerItr->Update(detectionUvsr);
-        trackerItr->UpdateConfidence(highConfidenceDetections[matchedIndex.row].confidence);
+        ObjectTracker &tracker = trackers[activeSlots[matchedIndex.col]];
+        tracker.Update(detectionUvsr);
+        tracker.UpdateConfidence(highConfidenceDetections[matchedIndex.row].confidence);
     }
 
-    std::list<ObjectTracker> remainedTrackers;
-
-    // Update trackers and initialize remained trackers
-    for (auto trackerItr = trackers.begin(); trackerItr != trackers.end();)
+    // 更新されたtrackerを前に詰め、更新されなかったtrackerをremainedSlotsに分ける (どちらも順序を保つ)
+    remainedSlots.clear();
+    numActive = 0;
+    for (const int slot : activeSlots)
     {
-        if (trackerItr->IsUpdated())
+        if (trackers[slot].IsUpdated())
         {
-            trackerItr++;
+            activeSlots[numActive++] = slot;
         }
         else
         {
-            remainedTrackers.push_back(*trackerItr); // Push back umatched trackers to remained trackers
-            trackerItr = trackers.erase(trackerItr);
+            remainedSlots.push_back(slot);
         }
     }
+    activeSlots.resize(numActive);
 
     // Second association from the detections with low confidence to remained trackers
-    std::list<RowCol> lowAssociations;
+    std::vector<RowCol> lowAssociations;
     std::vector<int> unmatchedLowDetectionIdcs;
     std::vector<BboxXyxy> remainedTrackedBboxesXyxy;
-    for (const ObjectTracker &tracker : remainedTrackers)
-    {
-        BboxXyxy xyxy;
-        getBboxesXyxy(tracker, xyxy);
-        remainedTrackedBboxesXyxy.push_back(xyxy);
-    }
+    getBboxesXyxy(remainedSlots, remainedTrackedBboxesXyxy);
     associateDetectionsToTrackers(lowConfidenceDetections, remainedTrackedBboxesXyxy, iouThresholdLow, lowAssociations,
                                   unmatchedLowDetectionIdcs);
 
@@ -316,25 +402,20 @@ void Byte::Exec(const std::vector<BboxXyxy> &detections, std::vector<TrackedBbox
     for (const RowCol &matchedIndex : lowAssociations)
     {
         const BboxUvsr detectionUvsr = BboxUtil::Xyxy2Uvsr(lowConfidenceDetections[matchedIndex.row]);
-        auto trackerItr = remainedTrackers.begin();
-        std::advance(trackerItr, matchedIndex.col);
-        trackerItr->Update(detectionUvsr);
-        trackerItr->UpdateConfidence(lowConfidenceDetections[matchedIndex.row].confidence);
+        ObjectTracker &tracker = trackers[remainedSlots[matchedIndex.col]];
+        tracker.Update(detectionUvsr);
+        tracker.UpdateConfidence(lowConfidenceDetections[matchedIndex.row].confidence);
     }
 
     // Merge unmatched trakers into trackers
-    trackers.splice(trackers.end(), remainedTrackers);
+    activeSlots.insert(activeSlots.end(), remainedSlots.begin(), remainedSlots.end());
 
     cleanTrackers();
 
     // 一回目にマッチングしていないdetectionをtrackerに追加する
     for (const int &detectionId : unmatchedHighDetectionIdcs)
     {
-        const BboxUvsr detection = BboxUtil::Xyxy2Uvsr(highConfidenceDetections[detectionId]);
-        ObjectTracker tracker(detection, numInitialFrame, minFrameSustained, currId,
-                              highConfidenceDetections[detectionId].confidence);
-        currId++;
-        trackers.push_back(tracker);
+        addTracker(highConfidenceDetections[detectionId]);
     }
 
     // Before numInitialFrame, add unmatched detections with low confidence to trackers
@@ -342,17 +423,14 @@ void Byte::Exec(const std::vector<BboxXyxy> &detections, std::vector<TrackedBbox
     {
         for (const int &detectionId : unmatchedLowDetectionIdcs)
         {
-            const BboxUvsr detection = BboxUtil::Xyxy2Uvsr(lowConfidenceDetections[detectionId]);
-            ObjectTracker tracker(detection, numInitialFrame, minFrameSustained, currId,
-                                  lowConfidenceDetections[detectionId].confidence);
-            currId++;
-            trackers.push_back(tracker);
+            addTracker(lowConfidenceDetections[detectionId]);
         }
     }
 
     // 可視状態のtrackerを保存する
-    for (ObjectTracker &tracker : trackers)
+    for (const int slot : activeSlots)
     {
+        ObjectTracker &tracker = trackers[slot];
         if (tracker.IsMatchedTrackVisible(currFrame))
         {
             tracker.Reveal();
@@ -366,9 +444,10 @@ void Byte::Exec(const std::vector<BboxXyxy> &detections, std::vector<TrackedBbox
     }
 
     // Detectionがない場合は、一回可視化されたtrackerの予測結果を保存する
-    for (const ObjectTracker &tracker : trackers)
+    for (const int slot : activeSlots)
     {
-        if (tracker.NumFrameDropped() > 0 && tracker.NumFrameDropped() <= maxAge && tracker.IsVisibleSoFar())
+        const ObjectTracker &tracker = trackers[slot];
+        if (tracker.NumFrameDropped() > 0 && tracker.TimeDropped() <= maxAge && tracker.IsVisibleSoFar())
         {
             BboxXyxy bodyXyxy;
             getBboxesXyxy(tracker, bodyXyxy);
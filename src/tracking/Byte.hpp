@@ -1,65 +1,126 @@
-/*
- * (c) 2023 Safie Inc.
- *
- * NOTICE: No part of this file may be reproduced, stored
- * in a retrieval system, or transmitted, in any form, or by any means,
- * electronic, mechanical, photocopying, recording, or otherwise,
- * without the prior consent of Safie Inc.
- */
-#pragma once
-
-#include "LinearSumAssignment.hpp"
-#include "ObjectTracker.hpp"
-
-/// @brief Byte トラッキングアルゴリズムを実行する。クリーンアーキテクチャにおけるユースケース層に所属する。
-class Byte
-{
-private:
-    std::list<ObjectTracker> trackers;
-
-    int currFrame; // 現在のフレーム
-    int currId;    // 現在のID
-
-    int maxAge;
-    int numInitialFrame;     // 連続検出の条件をスキップする初期フレーム数
-    int minFrameSustained;   // 何フレーム以上連続で検出された場合に可視化状態になる
-    double iouThresholdHigh; // used for first association
-    double iouThresholdLow;  // used for second association
-    double confidenceThreshold;
-    bool isSortOn;
-
-    static double calcIou(const BboxXyxy d1, const BboxXyxy d2);
-    static bool isMatchedUniquely(const cv::Mat iou_bigger_flag);
-    static cv::Mat calcIouMatrix(const std::vector<BboxXyxy> &srcs, const std::vector<BboxXyxy> &tgts);
-
-    void getBboxesXyxy(const ObjectTracker &tracker, BboxXyxy &xyxy) const;
-    void associateDetectionsToTrackers(const std::vector<BboxXyxy> &detections,
-                                       const std::vector<BboxXyxy> &trackedBboxesXyxy, const double iouThreshold,
-                                       std::list<RowCol> &associations, std::vector<int> &unmatchedDetectionIdcs) const;
-    void makeMatchedIdcs(const cv::Mat iouMatrix, std::list<RowCol> &matchedIdcs, const double iouThreshold) const;
-    void cleanTrackers();
-
-public:
-    Byte();
-    Byte(const int maxAge, const int numInitialFrame, const int minFrameSustained, const double iouThresholdHigh,
-         const double iouThresholdLow, const double confidenceThreshold, const bool isSortOn);
-    ~Byte(){};
-
-    void SetMaxAge(const int maxAge);
-    void SetNumInitialFrame(const int numIntialFrame);
-    void SetMinFrameSustained(const int minFrameSustained);
-    void SetIouThresholdHigh(const double iouThresholdHigh);
-    void SetIouThresholdLow(const double iouThresholdLow);
-    void SetConfidenceThreshold(const double confidenceThreshold);
-    void SetSortOn(const bool isSortOn);
-
-    double GetConfidenceThreshold() const { return confidenceThreshold; }
-
-    void Reset();
-
-    /// @brief Execute Byte algorithm
-    /// @param detections Input detections
-    /// @param visibleTracks Tracks that have association to a detection
-    void Exec(const std::vector<BboxXyxy> &detectedBBox, std::vector<TrackedBbox> &visibleTracks);
-    // TODO: TrackedBboxがスタンプ結合になっているので必要な変数だけ返却するようにする
-};
+/*
+ * (c) 2023 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+#pragma once
+
+#include "BboxUtil.hpp"
+#include "GatedAssociation.hpp"
+#include "LinearSumAssignment.hpp"
+#include "ObjectTracker.hpp"
+
+/// @brief Byte トラッキングアルゴリズムを実行する。クリーンアーキテクチャにおけるユースケース層に所属する。
+class Byte
+{
+private:
+    KalmanStateStore states;            // 全トラッカーのカルマンフィルタの状態
+    std::vector<ObjectTracker> trackers; // states のスロット番号で引くトラッカー。使用中のスロットだけが有効
+    std::vector<int> activeSlots;        // 使用中のスロット番号。トラッカーを追加した順 (更新されたものが先)
+    std::vector<int> remainedSlots;      // 一回目の割当で更新されなかったトラッカーのスロット番号
+
+    // 割当の作業領域 (フレームごとに使い回す)
+    BboxArray<double> detectionArray;
+    BboxArray<double> trackerArray;
+    LinearSumAssignment lsa;
+    std::vector<double> costMatrix;
+    std::vector<unsigned char> isDetectionMatched;
+    GatedAssociation gatedAssociation;
+
+    int currFrame; // 現在のフレーム
+    int currId;    // 現在のID
+
+    double frameInterval;  // 基準のフレーム間隔 [秒]。カルマンフィルタのパラメータと maxAge はこの間隔を 1 とする
+    double lastTimestamp;  // 前のフレームの時刻 [秒]
+    bool hasLastTimestamp; // lastTimestamp が有効かどうか
+
+    int maxAge;
+    int numInitialFrame;     // 連続検出の条件をスキップする初期フレーム数
+    int minFrameSustained;   // 何フレーム以上連続で検出された場合に可視化状態になる
+    double iouThresholdHigh; // used for first association
+    double iouThresholdLow;  // used for second association
+    double confidenceThreshold;
+    bool isSortOn;
+    bool isGatedAssociation;     // 空間的に絞り込んだ疎な割当を使う
+    double correctionNoiseScale; // Correct() の観測ノイズの検出に対する倍率
+
+    static bool isMatchedUniquely(const cv::Mat iou_bigger_flag);
+    cv::Mat calcIouMatrix(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackers);
+
+    void getBboxesXyxy(const ObjectTracker &tracker, BboxXyxy &xyxy) const;
+    void associateDetectionsToTrackers(const std::vector<BboxXyxy> &detections,
+                                       const std::vector<BboxXyxy> &trackedBboxesXyxy, const double iouThreshold,
+                                       std::vector<RowCol> &associations, std::vector<int> &unmatchedDetectionIdcs);
+    void makeMatchedIdcs(const cv::Mat iouMatrix, std::vector<RowCol> &matchedIdcs, const double iouThreshold);
+    void cleanTrackers();
+    void addTracker(const BboxXyxy &detection);
+    void getBboxesXyxy(const std::vector<int> &slots, std::vector<BboxXyxy> &xyxys) const;
+    double elapsedFrames(const double timestamp);
+    void exec(const std::vector<BboxXyxy> &detections, const double dt, std::vector<TrackedBbox> &visibleTracks);
+    void predict(const double dt, std::vector<TrackedBbox> &visibleTracks);
+
+public:
+    Byte();
+    Byte(const int maxAge, const int numInitialFrame, const int minFrameSustained, const double iouThresholdHigh,
+         const double iouThresholdLow, const double confidenceThreshold, const bool isSortOn);
+    ~Byte(){};
+    // トラッカーが states を指すのでコピーしない
+    Byte(const Byte &) = delete;
+    Byte &operator=(const Byte &) = delete;
+
+    void SetMaxAge(const int maxAge);
+    void SetNumInitialFrame(const int numIntialFrame);
+    void SetMinFrameSustained(const int minFrameSustained);
+    void SetIouThresholdHigh(const double iouThresholdHigh);
+    void SetIouThresholdLow(const double iouThresholdLow);
+    void SetConfidenceThreshold(const double confidenceThreshold);
+    void SetSortOn(const bool isSortOn);
+    /// @brief トラッカーのバウンディングボックスをグリッドで絞り込み、重なりのある組の連結成分ごとに割当を求める。
+    /// 混雑したシーンで割当の計算量をほぼ線形にする。IoU の閾値が 0 以下の割当には使わない
+    void SetGatedAssociation(const bool isGatedAssociation) { this->isGatedAssociation = isGatedAssociation; }
+
+    /// @brief 時刻付きの Exec() で経過時間の基準とするフレーム間隔 [秒]。
+    /// カルマンフィルタのノイズと maxAge はこの間隔で1フレームとして調整したものとして扱う
+    void SetFrameInterval(const double frameInterval) { this->frameInterval = frameInterval; }
+
+    double GetConfidenceThreshold() const { return confidenceThreshold; }
+    /// @brief 追跡中のトラッカーの数 (まだ可視になっていないものも含む)
+    int GetNumTrackers() const { return (int)activeSlots.size(); }
+
+    void Reset();
+
+    /// @brief Execute Byte algorithm
+    /// @param detections Input detections
+    /// @param visibleTracks Tracks that have association to a detection
+    void Exec(const std::vector<BboxXyxy> &detectedBBox, std::vector<TrackedBbox> &visibleTracks);
+    /// @brief 前のフレームからの経過時間に合わせて予測を進め、Byte algorithm を実行する。
+    /// フレームの間隔が変わったり、フレームが落ちたりしても、同じ時間には同じだけ予測が進む
+    /// @param timestamp フレームの時刻 [秒]。単調に増加するものとする
+    void Exec(const std::vector<BboxXyxy> &detectedBBox, const double timestamp,
+              std::vector<TrackedBbox> &visibleTracks);
+
+    /// @brief 検出を行わないフレームで、カルマンフィルタの予測だけで追跡を進める。
+    /// 一度可視になったトラッカーの予測位置と速度を返す (isBodyDetected は false)。
+    /// 経過時間は検出できていない時間に加えるので、時間で測る maxAge は検出の間隔によらず同じ時間で切れる。
+    /// 検出されなかったフレームとは数えないので、連続検出の判定には影響しない
+    void Predict(std::vector<TrackedBbox> &visibleTracks);
+    /// @brief 前のフレームからの経過時間だけ予測を進める
+    /// @param timestamp フレームの時刻 [秒]。Exec() と共通の時刻とする
+    void Predict(const double timestamp, std::vector<TrackedBbox> &visibleTracks);
+
+    /// @brief 検出を行わないフレームで、検出以外の方法 (オプティカルフローなど) で動かしたボックスでトラッカーを補正する。
+    /// カルマンフィルタの状態だけを更新するので、次の予測と割当には反映されるが、maxAge や連続検出の判定には
+    /// 影響しない。Predict() の後に呼ぶ
+    /// @param[in,out] track id と bodyBbox を補正に使い、velocity を補正後の速度にする
+    /// @retval track.id のトラッカーがなければ false
+    bool Correct(TrackedBbox &track);
+    /// @brief Correct() の観測ノイズを検出の何倍とみなすか
+    void SetCorrectionNoiseScale(const double correctionNoiseScale) { this->correctionNoiseScale = correctionNoiseScale; }
+
+    /// @brief 一度可視になったトラッカーの中心位置の分散の最大値。トラッカーがなければ 0
+    double GetMaxPositionVariance() const;
+    // TODO: TrackedBboxがスタンプ結合になっているので必要な変数だけ返却するようにする
+};
@@ -0,0 +1,209 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "FlowPropagator.hpp"
+#include "MathUtil.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// 特徴点を選ぶのに必要なボックスの最小の幅と高さ [pixel]
+static const int minBoxSize = 8;
+// 1フレームで許す拡大縮小の範囲
+static const float minScale = 0.8f;
+static const float maxScale = 1.25f;
+
+/// @brief 配列の中央値を求める (順序は入れ替わる)。空でないものとする
+static float median(std::vector<float> &values)
+{
+    const std::vector<float>::iterator mid = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), mid, values.end());
+    return *mid;
+}
+
+FlowPropagator::FlowPropagator() : processingWidth(640), maxCornersPerBox(20), minPoints(4), maxFbError(1.0) {}
+
+void FlowPropagator::Reset()
+{
+    prevGray.release();
+    prevBoxes.clear();
+}
+
+/// @brief RGB 画像をフローを計算するグレースケール画像にする
+void FlowPropagator::toGray(const cv::Mat &rgbImage, cv::Mat &gray) const
+{
+    if (processingWidth > 0 && rgbImage.cols > processingWidth)
+    {
+        const int height = (int)std::round((double)rgbImage.rows * processingWidth / rgbImage.cols);
+        cv::Mat resized;
+        cv::resize(rgbImage, resized, cv::Size(processingWidth, height), 0, 0, cv::INTER_AREA);
+        cv::cvtColor(resized, gray, cv::COLOR_RGB2GRAY);
+    }
+    else
+    {
+        cv::cvtColor(rgbImage, gray, cv::COLOR_RGB2GRAY);
+    }
+}
+
+void FlowPropagator::storeBoxes(const std::vector<TrackedBbox> &tracks)
+{
+    prevBoxes.clear();
+    for (const TrackedBbox &track : tracks)
+    {
+        prevBoxes[track.id] = track.bodyBbox;
+    }
+}
+
+/// @brief 前のフレームの画像上の点が、id 以外のトラックのボックスに入っているか調べる
+bool FlowPropagator::isInsideOtherBox(const cv::Point2f &point, const unsigned int id) const
+{
+    const double x = (double)point.x / prevGray.cols;
+    const double y = (double)point.y / prevGray.rows;
+    for (const std::pair<const unsigned int, BboxXyxy> &entry : prevBoxes)
+    {
+        const BboxXyxy &box = entry.second;
+        if (entry.first != id && x >= box.x0 && x < box.x1 && y >= box.y0 && y < box.y1) return true;
+    }
+    return false;
+}
+
+void FlowPropagator::SetReference(const cv::Mat &rgbImage, const std::vector<TrackedBbox> &tracks)
+{
+    toGray(rgbImage, prevGray);
+    storeBoxes(tracks);
+}
+
+/// @brief prevPoints の [begin, end) の点の動きから、ボックスの移動量と拡大率を求める
+/// @retval 追跡できた点が minPoints 未満なら false
+bool FlowPropagator::estimateMotion(const int begin, const int end, float &dx, float &dy, float &scale)
+{
+    // 順方向と逆方向の両方で追跡でき、元の位置に戻った点だけを使う。使わない点は status を 0 にする
+    dxs.clear();
+    dys.clear();
+    for (int i = begin; i < end; i++)
+    {
+        const float fbx = backPoints[i].x - prevPoints[i].x;
+        const float fby = backPoints[i].y - prevPoints[i].y;
+        if (!status[i] || !backStatus[i] || fbx * fbx + fby * fby > maxFbError * maxFbError)
+        {
+            status[i] = 0;
+            continue;
+        }
+        dxs.push_back(currPoints[i].x - prevPoints[i].x);
+        dys.push_back(currPoints[i].y - prevPoints[i].y);
+    }
+    if ((int)dxs.size() < minPoints) return false;
+    dx = median(dxs);
+    dy = median(dys);
+
+    // 点の重心からの距離の比で拡大率を求める
+    float prevCx = 0.0f;
+    float prevCy = 0.0f;
+    int numValid = 0;
+    for (int i = begin; i < end; i++)
+    {
+        if (!status[i]) continue;
+        prevCx += prevPoints[i].x;
+        prevCy += prevPoints[i].y;
+        numValid++;
+    }
+    prevCx /= numValid;
+    prevCy /= numValid;
+    scales.clear();
+    for (int i = begin; i < end; i++)
+    {
+        if (!status[i]) continue;
+        const float prevDist = std::hypot(prevPoints[i].x - prevCx, prevPoints[i].y - prevCy);
+        const float currDist = std::hypot(currPoints[i].x - prevCx - dx, currPoints[i].y - prevCy - dy);
+        if (prevDist > 1.0f) scales.push_back(currDist / prevDist);
+    }
+    scale = scales.empty() ? 1.0f : MathUtil::Clamp<float>(median(scales), minScale, maxScale);
+    return true;
+}
+
+void FlowPropagator::Propagate(const cv::Mat &rgbImage, std::vector<TrackedBbox> &tracks,
+                               std::vector<unsigned char> *isPropagated)
+{
+    if (isPropagated != nullptr) isPropagated->assign(tracks.size(), 0);
+    if (prevGray.empty())
+    {
+        SetReference(rgbImage, tracks);
+        return;
+    }
+    toGray(rgbImage, currGray);
+    if (currGray.size() != prevGray.size())
+    {
+        SetReference(rgbImage, tracks);
+        return;
+    }
+    const float width = (float)prevGray.cols;
+    const float height = (float)prevGray.rows;
+
+    // 前のフレームの各ボックス内で特徴点を選ぶ。重なった人物の動きが混ざらないよう、
+    // 他のトラックのボックスにも入る点は使わない
+    prevPoints.clear();
+    pointOffsets.assign(1, 0);
+    for (const TrackedBbox &track : tracks)
+    {
+        const std::unordered_map<unsigned int, BboxXyxy>::const_iterator found = prevBoxes.find(track.id);
+        if (found != prevBoxes.end())
+        {
+            const BboxXyxy &box = found->second;
+            const int x0 = MathUtil::Clamp<int>((int)(box.x0 * width), 0, prevGray.cols);
+            const int y0 = MathUtil::Clamp<int>((int)(box.y0 * height), 0, prevGray.rows);
+            const int x1 = MathUtil::Clamp<int>((int)(box.x1 * width), 0, prevGray.cols);
+            const int y1 = MathUtil::Clamp<int>((int)(box.y1 * height), 0, prevGray.rows);
+            if (x1 - x0 >= minBoxSize && y1 - y0 >= minBoxSize)
+            {
+                const cv::Rect roi(x0, y0, x1 - x0, y1 - y0);
+                const double minDistance = std::max(std::min(roi.width, roi.height) / 10.0, 2.0);
+                cv::goodFeaturesToTrack(prevGray(roi), corners, maxCornersPerBox, 0.01, minDistance);
+                for (const cv::Point2f &corner : corners)
+                {
+                    const cv::Point2f point(corner.x + x0, corner.y + y0);
+                    if (!isInsideOtherBox(point, track.id)) prevPoints.push_back(point);
+                }
+            }
+        }
+        pointOffsets.push_back((int)prevPoints.size());
+    }
+
+    if (!prevPoints.empty())
+    {
+        // 全トラックの点をまとめて順方向と逆方向に追跡する
+        const cv::Size winSize(21, 21);
+        const int maxLevel = 3;
+        cv::calcOpticalFlowPyrLK(prevGray, currGray, prevPoints, currPoints, status, errors, winSize, maxLevel);
+        cv::calcOpticalFlowPyrLK(currGray, prevGray, currPoints, backPoints, backStatus, errors, winSize, maxLevel);
+
+        for (size_t t = 0; t < tracks.size(); t++)
+        {
+            float dx, dy, scale;
+            if (pointOffsets[t] == pointOffsets[t + 1]) continue;
+            if (!estimateMotion(pointOffsets[t], pointOffsets[t + 1], dx, dy, scale)) continue;
+
+            // 前のフレームのボックスを動かす
+            const BboxXyxy &prev = prevBoxes[tracks[t].id];
+            const double cx = prev.x_center() + dx / width;
+            const double cy = prev.y_center() + dy / height;
+            const double halfW = (prev.x1 - prev.x0) * scale / 2;
+            const double halfH = (prev.y1 - prev.y0) * scale / 2;
+            BboxXyxy &box = tracks[t].bodyBbox;
+            box.x0 = MathUtil::Clamp<double>(cx - halfW, 0.0, 1.0);
+            box.y0 = MathUtil::Clamp<double>(cy - halfH, 0.0, 1.0);
+            box.x1 = MathUtil::Clamp<double>(cx + halfW, 0.0, 1.0);
+            box.y1 = MathUtil::Clamp<double>(cy + halfH, 0.0, 1.0);
+            if (isPropagated != nullptr) (*isPropagated)[t] = 1;
+        }
+    }
+
+    // 動かしたボックスと今のフレームを次のフレームの基準にする
+    storeBoxes(tracks);
+    cv::swap(prevGray, currGray);
+}
@@ -0,0 +1,73 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "Types.hpp"
+
+/// @brief 疎なオプティカルフローで、物体検出を行わないフレームの人物のバウンディングボックスを前のフレームから動かす。
+/// 前のフレームの各ボックス内で、他のボックスと重ならない部分からコーナー特徴点を選び、
+/// 全ボックス分をまとめて calcOpticalFlowPyrLK で追跡する。
+/// 逆方向にも追跡して元の位置に戻らない点を除き、残った点の移動量の中央値と中心からの距離の比の中央値で
+/// ボックスを平行移動・拡大縮小する。十分な点が残らないトラックはカルマンフィルタの予測のままとする。
+/// 画像は縮小したグレースケールで扱い、バッファはメンバーに持って使い回す。
+class FlowPropagator
+{
+private:
+    int processingWidth;  // フローを計算する画像の幅 [pixel]。0 以下なら元の大きさ
+    int maxCornersPerBox; // 1つのボックスで選ぶ特徴点の上限
+    int minPoints;        // ボックスを動かすのに必要な追跡できた点の数
+    double maxFbError;    // 順方向と逆方向の追跡のずれの上限 [pixel]
+
+    cv::Mat prevGray;
+    std::unordered_map<unsigned int, BboxXyxy> prevBoxes; // トラック ID から前のフレームのボックスへの対応
+
+    // 作業領域
+    cv::Mat currGray;
+    std::vector<cv::Point2f> corners;
+    std::vector<cv::Point2f> prevPoints;
+    std::vector<cv::Point2f> currPoints;
+    std::vector<cv::Point2f> backPoints;
+    std::vector<unsigned char> status;
+    std::vector<unsigned char> backStatus;
+    std::vector<float> errors;
+    std::vector<int> pointOffsets; // トラックごとの prevPoints 内の開始位置
+    std::vector<float> dxs;
+    std::vector<float> dys;
+    std::vector<float> scales;
+
+    void toGray(const cv::Mat &rgbImage, cv::Mat &gray) const;
+    void storeBoxes(const std::vector<TrackedBbox> &tracks);
+    bool isInsideOtherBox(const cv::Point2f &point, const unsigned int id) const;
+    bool estimateMotion(const int begin, const int end, float &dx, float &dy, float &scale);
+
+public:
+    FlowPropagator();
+    ~FlowPropagator(){};
+
+    /// @brief フローを計算する画像の幅を指定する。0 以下なら元の大きさで計算する
+    void SetProcessingWidth(const int processingWidth) { this->processingWidth = processingWidth; }
+
+    /// @brief 前のフレームの画像とボックスを捨てる
+    void Reset();
+
+    /// @brief 物体検出を行ったフレームの画像と追跡結果を、次のフレームの追跡の基準として記録する
+    void SetReference(const cv::Mat &rgbImage, const std::vector<TrackedBbox> &tracks);
+
+    /// @brief 前のフレームから tracks の bodyBbox を動かし、結果を次のフレームの基準として記録する。
+    /// 前のフレームにないトラックと、十分な点を追跡できなかったトラックは与えられたボックスのままとする
+    /// @param[in,out] tracks カルマンフィルタで予測したトラック
+    /// @param[out] isPropagated nullptr でなければ、tracks の各要素をフローで動かしたら 1、予測のままなら 0 にする
+    void Propagate(const cv::Mat &rgbImage, std::vector<TrackedBbox> &tracks,
+                   std::vector<unsigned char> *isPropagated = nullptr);
+};
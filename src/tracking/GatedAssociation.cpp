@@ -0,0 +1,255 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "GatedAssociation.hpp"
+#include "BboxUtil.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// グリッドの1辺のセル数の上限
+static const int maxGridSize = 64;
+
+int GatedAssociation::findRoot(int node)
+{
+    while (parents[node] != node)
+    {
+        parents[node] = parents[parents[node]];
+        node = parents[node];
+    }
+    return node;
+}
+
+/// @brief IoU が正の組を edges に集める
+void GatedAssociation::collectEdges(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackers)
+{
+    edges.clear();
+    const int numTrackers = (int)trackers.size();
+
+    // トラッカー全体を囲む範囲と平均の大きさからセルの大きさを決める
+    double minX = trackers[0].x0;
+    double minY = trackers[0].y0;
+    double maxX = trackers[0].x1;
+    double maxY = trackers[0].y1;
+    double sumW = 0.0;
+    double sumH = 0.0;
+    for (const BboxXyxy &t : trackers)
+    {
+        minX = std::min(minX, t.x0);
+        minY = std::min(minY, t.y0);
+        maxX = std::max(maxX, t.x1);
+        maxY = std::max(maxY, t.y1);
+        sumW += std::max(t.x1 - t.x0, 0.0);
+        sumH += std::max(t.y1 - t.y0, 0.0);
+    }
+    const double spanX = std::max(maxX - minX, 1e-6);
+    const double spanY = std::max(maxY - minY, 1e-6);
+    const double meanW = std::max(sumW / numTrackers, 1e-6);
+    const double meanH = std::max(sumH / numTrackers, 1e-6);
+    const int gridW = std::min(std::max((int)std::ceil(spanX / meanW), 1), maxGridSize);
+    const int gridH = std::min(std::max((int)std::ceil(spanY / meanH), 1), maxGridSize);
+    const double cellW = spanX / gridW;
+    const double cellH = spanY / gridH;
+    const auto cellX = [minX, cellW, gridW](const double x) {
+        return std::min(std::max((int)((x - minX) / cellW), 0), gridW - 1);
+    };
+    const auto cellY = [minY, cellH, gridH](const double y) {
+        return std::min(std::max((int)((y - minY) / cellH), 0), gridH - 1);
+    };
+
+    if ((int)gridCells.size() < gridW * gridH) gridCells.resize(gridW * gridH);
+    for (int c = 0; c < gridW * gridH; c++)
+    {
+        gridCells[c].clear();
+    }
+    for (int t = 0; t < numTrackers; t++)
+    {
+        const int cx1 = cellX(trackers[t].x1);
+        const int cy1 = cellY(trackers[t].y1);
+        for (int cy = cellY(trackers[t].y0); cy <= cy1; cy++)
+        {
+            for (int cx = cellX(trackers[t].x0); cx <= cx1; cx++)
+            {
+                gridCells[cy * gridW + cx].push_back(t);
+            }
+        }
+    }
+
+    // 重なりのある検出結果とトラッカーは、少なくとも1つのセルを共有する
+    lastVisited.assign(numTrackers, -1);
+    for (int d = 0; d < (int)detections.size(); d++)
+    {
+        const BboxXyxy &det = detections[d];
+        const int cx1 = cellX(det.x1);
+        const int cy1 = cellY(det.y1);
+        for (int cy = cellY(det.y0); cy <= cy1; cy++)
+        {
+            for (int cx = cellX(det.x0); cx <= cx1; cx++)
+            {
+                for (const int t : gridCells[cy * gridW + cx])
+                {
+                    if (lastVisited[t] == d) continue;
+                    lastVisited[t] = d;
+                    const double iou = BboxUtil::CalcIou(trackers[t], det);
+                    if (iou > 0.0)
+                    {
+                        Edge edge;
+                        edge.detection = d;
+                        edge.tracker = t;
+                        edge.iou = iou;
+                        edges.push_back(edge);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// @brief 1つの連結成分の割当を求める
+void GatedAssociation::solveComponent(const Edge *begin, const Edge *end, const double iouThreshold,
+                                      std::vector<RowCol> &associations)
+{
+    // 成分内の検出結果とトラッカーに行番号・列番号を振る
+    localDetections.clear();
+    localTrackers.clear();
+    for (const Edge *e = begin; e != end; e++)
+    {
+        if (localIdcs[e->detection] == -1)
+        {
+            localIdcs[e->detection] = (int)localDetections.size();
+            localDetections.push_back(e->detection);
+        }
+        if (localIdcs[e->tracker] == -1)
+        {
+            localIdcs[e->tracker] = (int)localTrackers.size();
+            localTrackers.push_back(e->tracker);
+        }
+    }
+    const int nrows = (int)localDetections.size();
+    const int ncols = (int)localTrackers.size();
+
+    // IoU が閾値より大きい組が各行各列に1つ以下なら、割当は一意に決まる
+    rowCounts.assign(nrows, 0);
+    colCounts.assign(ncols, 0);
+    bool isUnique = true;
+    for (const Edge *e = begin; e != end; e++)
+    {
+        if (e->iou > iouThreshold)
+        {
+            if (++rowCounts[localIdcs[e->detection]] > 1 || ++colCounts[localIdcs[e->tracker]] > 1)
+            {
+                isUnique = false;
+            }
+        }
+    }
+
+    if (isUnique)
+    {
+        for (const Edge *e = begin; e != end; e++)
+        {
+            if (e->iou > iouThreshold)
+            {
+                RowCol rc;
+                rc.row = e->detection;
+                rc.col = e->tracker;
+                associations.push_back(rc);
+            }
+        }
+    }
+    else
+    {
+        // 成分の小さなコスト行列で線形割当を解き、iouThreshold未満の組は除く
+        costMatrix.assign((size_t)nrows * ncols, 0.0);
+        for (const Edge *e = begin; e != end; e++)
+        {
+            costMatrix[(size_t)localIdcs[e->detection] * ncols + localIdcs[e->tracker]] = -e->iou;
+        }
+        lsa.Solve(costMatrix.data(), nrows, ncols, localAssociations);
+        for (const RowCol &local : localAssociations)
+        {
+            if (-costMatrix[(size_t)local.row * ncols + local.col] < iouThreshold) continue;
+            RowCol rc;
+            rc.row = localDetections[local.row];
+            rc.col = localTrackers[local.col];
+            associations.push_back(rc);
+        }
+    }
+
+    for (const int d : localDetections)
+    {
+        localIdcs[d] = -1;
+    }
+    for (const int t : localTrackers)
+    {
+        localIdcs[t] = -1;
+    }
+}
+
+void GatedAssociation::Associate(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackers,
+                                 const double iouThreshold, std::vector<RowCol> &associations)
+{
+    associations.clear();
+    if (detections.empty() || trackers.empty()) return;
+
+    collectEdges(detections, trackers);
+
+    // 検出結果を 0 から、トラッカーを detections.size() から始まる頂点として連結成分に分ける
+    const int numDetections = (int)detections.size();
+    const int numNodes = numDetections + (int)trackers.size();
+    parents.resize(numNodes);
+    for (int i = 0; i < numNodes; i++)
+    {
+        parents[i] = i;
+    }
+    for (Edge &e : edges)
+    {
+        e.tracker += numDetections;
+        const int a = findRoot(e.detection);
+        const int b = findRoot(e.tracker);
+        if (a != b) parents[std::max(a, b)] = std::min(a, b);
+    }
+
+    // 辺を連結成分ごとにまとめる (計数ソート)
+    componentOf.assign(numNodes, -1);
+    componentOffsets.assign(1, 0);
+    for (const Edge &e : edges)
+    {
+        const int root = findRoot(e.detection);
+        if (componentOf[root] == -1)
+        {
+            componentOf[root] = (int)componentOffsets.size() - 1;
+            componentOffsets.push_back(0);
+        }
+        componentOffsets[componentOf[root] + 1]++;
+    }
+    const int numComponents = (int)componentOffsets.size() - 1;
+    for (int c = 0; c < numComponents; c++)
+    {
+        componentOffsets[c + 1] += componentOffsets[c];
+    }
+    componentCursors.assign(componentOffsets.begin(), componentOffsets.end() - 1);
+    sortedEdges.resize(edges.size());
+    for (const Edge &e : edges)
+    {
+        sortedEdges[componentCursors[componentOf[findRoot(e.detection)]]++] = e;
+    }
+
+    localIdcs.assign(numNodes, -1);
+    for (int c = 0; c < numComponents; c++)
+    {
+        solveComponent(sortedEdges.data() + componentOffsets[c], sortedEdges.data() + componentOffsets[c + 1],
+                       iouThreshold, associations);
+    }
+
+    // トラッカーの番号を元に戻す
+    for (RowCol &rc : associations)
+    {
+        rc.col -= numDetections;
+    }
+}
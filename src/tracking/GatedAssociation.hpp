@@ -0,0 +1,64 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "LinearSumAssignment.hpp"
+#include "Types.hpp"
+
+/// @brief 空間的な絞り込みを行う検出結果とトラッカーの割当。
+/// トラッカーのバウンディングボックスを一様グリッドに登録し、同じセルを共有する組だけ IoU を計算して、
+/// IoU が正の組を辺とする疎な二部グラフを作る。グラフを連結成分に分け、成分ごとに独立に割当を求める。
+/// 閾値を超える組が成分内で一意に決まる場合はそのまま採用し、そうでなければ成分の小さなコスト行列で線形割当を解く。
+/// 重なりのない組は割当に影響しないため、成分ごとの最適割当を合わせたものは全体の最適割当になる。
+class GatedAssociation
+{
+private:
+    /// @brief IoU が正の検出結果とトラッカーの組
+    struct Edge
+    {
+        int detection;
+        int tracker;
+        double iou;
+    };
+
+    // 作業領域 (呼び出しごとに使い回す)
+    std::vector<std::vector<int>> gridCells;
+    std::vector<int> lastVisited; // トラッカーごとに最後に IoU を計算した検出結果の番号
+    std::vector<Edge> edges;
+    std::vector<int> parents; // 検出結果、トラッカーの順に並べた頂点の union-find
+    std::vector<int> componentOffsets;
+    std::vector<int> componentCursors;
+    std::vector<int> componentOf; // 根の頂点から成分番号への対応
+    std::vector<Edge> sortedEdges;
+    std::vector<int> localIdcs;  // 頂点から成分内の行番号・列番号への対応
+    std::vector<int> rowCounts;
+    std::vector<int> colCounts;
+    std::vector<int> localDetections;
+    std::vector<int> localTrackers;
+    std::vector<double> costMatrix;
+    std::vector<RowCol> localAssociations;
+    LinearSumAssignment lsa;
+
+    int findRoot(int node);
+    void collectEdges(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackers);
+    void solveComponent(const Edge *begin, const Edge *end, const double iouThreshold,
+                        std::vector<RowCol> &associations);
+
+public:
+    GatedAssociation(){};
+    ~GatedAssociation(){};
+
+    /// @brief 検出結果とトラッカーを割り当てる。iouThreshold は正の値とする
+    /// @param[out] associations 割当の結果。row が検出結果、col がトラッカーの番号
+    void Associate(const std::vector<BboxXyxy> &detections, const std::vector<BboxXyxy> &trackers,
+                   const double iouThreshold, std::vector<RowCol> &associations);
+};
@@ -0,0 +1,376 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "KalmanStateStore.hpp"
+#include "SimdUtil.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Kalman Filter パラメータ (全トラッカーで共有)
+// 時間遷移を表す行列 F は単位行列に (u, v, s) へ (du, dv, ds) の dt 倍を足す項を加えたもの。
+// dt は基準のフレーム間隔を 1 とした経過時間で、速度も基準のフレーム間隔あたりの変化量とする
+// 状態変数と観測変数の変換を表す行列 H は状態の先頭4要素を取り出すもの
+// 観測ノイズの共分散行列 R (対角成分)
+static const double measurementNoise[KalmanStateStore::measureDim] = {1, 1, 10, 10};
+// 基準のフレーム間隔あたりのノイズの共分散行列 Q (対角成分)。予測では dt 倍して使う
+static const double processNoise[KalmanStateStore::stateDim] = {1, 1, 1, 1, 0.01, 0.01, 0.0001};
+// 誤差の共分散行列の初期値 (対角成分)
+static const double initialCovariance[KalmanStateStore::stateDim] = {10, 10, 10, 10, 10000, 10000, 10000};
+
+/// @brief 4x4 の対称正定値行列 S について S * X = B を解く (B は 4 x numCols、X で上書きする)。
+/// コレスキー分解で解き、正定値でない場合は部分ピボット選択付きのガウスの消去法で解く。
+static void solveSymmetric4(const double S[4][4], double B[4][KalmanStateStore::stateDim], const int numCols)
+{
+    double L[4][4] = {};
+    bool isPositiveDefinite = true;
+    for (int i = 0; i < 4 && isPositiveDefinite; i++)
+    {
+        for (int j = 0; j <= i; j++)
+        {
+            double sum = S[i][j];
+            for (int k = 0; k < j; k++)
+            {
+                sum -= L[i][k] * L[j][k];
+            }
+            if (i == j)
+            {
+                if (sum <= 0.0)
+                {
+                    isPositiveDefinite = false;
+                    break;
+                }
+                L[i][i] = std::sqrt(sum);
+            }
+            else
+            {
+                L[i][j] = sum / L[j][j];
+            }
+        }
+    }
+
+    if (isPositiveDefinite)
+    {
+        for (int c = 0; c < numCols; c++)
+        {
+            // L * y = b
+            for (int i = 0; i < 4; i++)
+            {
+                double sum = B[i][c];
+                for (int k = 0; k < i; k++)
+                {
+                    sum -= L[i][k] * B[k][c];
+                }
+                B[i][c] = sum / L[i][i];
+            }
+            // L^T * x = y
+            for (int i = 3; i >= 0; i--)
+            {
+                double sum = B[i][c];
+                for (int k = i + 1; k < 4; k++)
+                {
+                    sum -= L[k][i] * B[k][c];
+                }
+                B[i][c] = sum / L[i][i];
+            }
+        }
+        return;
+    }
+
+    double A[4][4];
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            A[i][j] = S[i][j];
+        }
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        int pivot = k;
+        for (int i = k + 1; i < 4; i++)
+        {
+            if (std::fabs(A[i][k]) > std::fabs(A[pivot][k])) pivot = i;
+        }
+        if (A[pivot][k] == 0.0) continue;
+        if (pivot != k)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                std::swap(A[k][j], A[pivot][j]);
+            }
+            for (int c = 0; c < numCols; c++)
+            {
+                std::swap(B[k][c], B[pivot][c]);
+            }
+        }
+        for (int i = k + 1; i < 4; i++)
+        {
+            const double f = A[i][k] / A[k][k];
+            for (int j = k; j < 4; j++)
+            {
+                A[i][j] -= f * A[k][j];
+            }
+            for (int c = 0; c < numCols; c++)
+            {
+                B[i][c] -= f * B[k][c];
+            }
+        }
+    }
+    for (int c = 0; c < numCols; c++)
+    {
+        for (int i = 3; i >= 0; i--)
+        {
+            double sum = B[i][c];
+            for (int k = i + 1; k < 4; k++)
+            {
+                sum -= A[i][k] * B[k][c];
+            }
+            B[i][c] = (A[i][i] != 0.0) ? sum / A[i][i] : 0.0;
+        }
+    }
+}
+
+/// @brief スロット [begin, end) のバウンディングボックスを状態から計算し直す
+void KalmanStateStore::updateBoxes(const int begin, const int end)
+{
+    for (int k = begin; k < end; k++)
+    {
+        const double u = states[0][k];
+        const double v = states[1][k];
+        const double s = states[2][k];
+        const double w = std::sqrt(s * states[3][k]);
+        const double h = s / w;
+        boxes[k] = BboxXyxy(u - w / 2, v - h / 2, u + w / 2, v + h / 2);
+    }
+}
+
+/// @brief スロット [begin, end) の状態を dt だけ進める。
+/// F は (u, v, s) の行に (du, dv, ds) の行の dt 倍を足す行列なので、x = F * x と P = F * P * F^T + Q * dt は
+/// 共分散の要素ごとの配列の足し込みになる。dt = 1 のときは固定間隔の計算と同じ結果になる。
+static void predictRange(std::vector<double> *states, std::vector<double> *covariances, const double dt,
+                         const int begin, const int end)
+{
+    const int stateDim = KalmanStateStore::stateDim;
+    const int n = end - begin;
+
+    // スケールはマイナスになるとbbox_x1y1x2y2に変換時にnanが発生するので0に。
+    // (特に微分値をケア)。
+    double *s = states[2].data() + begin;
+    double *ds = states[6].data() + begin;
+    for (int k = 0; k < n; k++)
+    {
+        if (ds[k] * dt + s[k] <= 0)
+        {
+            ds[k] *= 0.0;
+        }
+    }
+
+    // x = F * x
+    for (int i = 0; i < 3; i++)
+    {
+        SimdUtil::AccumulateScaled(states[i].data() + begin, states[i + 4].data() + begin, dt, n);
+    }
+
+    // P = F * P * F^T + Q
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < stateDim; j++)
+        {
+            SimdUtil::AccumulateScaled(covariances[i * stateDim + j].data() + begin,
+                                       covariances[(i + 4) * stateDim + j].data() + begin, dt, n);
+        }
+    }
+    for (int i = 0; i < stateDim; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            SimdUtil::AccumulateScaled(covariances[i * stateDim + j].data() + begin,
+                                       covariances[i * stateDim + j + 4].data() + begin, dt, n);
+        }
+    }
+    for (int i = 0; i < stateDim; i++)
+    {
+        double *p = covariances[i * stateDim + i].data() + begin;
+        const double q = processNoise[i] * dt;
+        for (int k = 0; k < n; k++)
+        {
+            p[k] += q;
+        }
+    }
+}
+
+int KalmanStateStore::Allocate(const BboxUvsr &bbox)
+{
+    int slot;
+    if (!freeSlots.empty())
+    {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else
+    {
+        slot = numSlots++;
+        for (int i = 0; i < stateDim; i++)
+        {
+            states[i].resize(numSlots);
+        }
+        for (int i = 0; i < stateDim * stateDim; i++)
+        {
+            covariances[i].resize(numSlots);
+        }
+        boxes.resize(numSlots);
+        isUsed.resize(numSlots);
+    }
+    isUsed[slot] = 1;
+
+    // 状態変数
+    states[0][slot] = bbox.u;
+    states[1][slot] = bbox.v;
+    states[2][slot] = bbox.s;
+    states[3][slot] = bbox.r;
+    states[4][slot] = 0;
+    states[5][slot] = 0;
+    states[6][slot] = 0;
+
+    // 誤差の共分散行列
+    // トラッキングデータごとに内部で変化・ここでは初期値のみ指定
+    for (int i = 0; i < stateDim; i++)
+    {
+        for (int j = 0; j < stateDim; j++)
+        {
+            covariance(i, j)[slot] = (i == j) ? initialCovariance[i] : 0.0;
+        }
+    }
+    updateBoxes(slot, slot + 1);
+    return slot;
+}
+
+void KalmanStateStore::Release(const int slot)
+{
+    if (!isUsed[slot]) return;
+    isUsed[slot] = 0;
+    freeSlots.push_back(slot);
+}
+
+void KalmanStateStore::Clear()
+{
+    numSlots = 0;
+    for (int i = 0; i < stateDim; i++)
+    {
+        states[i].clear();
+    }
+    for (int i = 0; i < stateDim * stateDim; i++)
+    {
+        covariances[i].clear();
+    }
+    boxes.clear();
+    isUsed.clear();
+    freeSlots.clear();
+}
+
+void KalmanStateStore::PredictAll(const double dt)
+{
+    predictRange(states, covariances, dt, 0, numSlots);
+    updateBoxes(0, numSlots);
+}
+
+void KalmanStateStore::Predict(const int slot, const double dt)
+{
+    predictRange(states, covariances, dt, slot, slot + 1);
+    updateBoxes(slot, slot + 1);
+}
+
+/// @brief Kalman Filterを更新する
+void KalmanStateStore::Update(const int slot, const BboxUvsr &bbox, const double noiseScale)
+{
+    // 対象スロットの状態と誤差の共分散行列を取り出して計算し、書き戻す
+    double x[stateDim];
+    double P[stateDim][stateDim];
+    for (int i = 0; i < stateDim; i++)
+    {
+        x[i] = states[i][slot];
+        for (int j = 0; j < stateDim; j++)
+        {
+            P[i][j] = covariance(i, j)[slot];
+        }
+    }
+
+    // e = z - H * x
+    const double z[measureDim] = {bbox.u, bbox.v, bbox.s, bbox.r};
+    double e[measureDim];
+    for (int i = 0; i < measureDim; i++)
+    {
+        e[i] = z[i] - x[i];
+    }
+
+    // S = R + H * P * H^T (P の左上 4x4 に観測ノイズを足したもの)
+    double S[measureDim][measureDim];
+    for (int i = 0; i < measureDim; i++)
+    {
+        for (int j = 0; j < measureDim; j++)
+        {
+            S[i][j] = P[i][j];
+        }
+        S[i][i] += measurementNoise[i] * noiseScale;
+    }
+
+    // K = P * H^T * S^-1。S と P は対称なので K^T = S^-1 * (H * P) を解く
+    double Kt[measureDim][stateDim];
+    for (int i = 0; i < measureDim; i++)
+    {
+        for (int j = 0; j < stateDim; j++)
+        {
+            Kt[i][j] = P[i][j];
+        }
+    }
+    solveSymmetric4(S, Kt, stateDim);
+
+    // x = x + K * e
+    for (int j = 0; j < stateDim; j++)
+    {
+        double sum = 0.0;
+        for (int i = 0; i < measureDim; i++)
+        {
+            sum += Kt[i][j] * e[i];
+        }
+        states[j][slot] = x[j] + sum;
+    }
+
+    // P = (I - K * H) * P = P - K * (H * P)。H * P は P の先頭4行
+    for (int a = 0; a < stateDim; a++)
+    {
+        for (int b = 0; b < stateDim; b++)
+        {
+            double sum = 0.0;
+            for (int i = 0; i < measureDim; i++)
+            {
+                sum += Kt[i][a] * P[i][b];
+            }
+            covariance(a, b)[slot] = P[a][b] - sum;
+        }
+    }
+    updateBoxes(slot, slot + 1);
+}
+
+BboxUvsr KalmanStateStore::GetBbox(const int slot) const
+{
+    BboxUvsr ret;
+    ret.u = states[0][slot];
+    ret.v = states[1][slot];
+    ret.s = states[2][slot];
+    ret.r = states[3][slot];
+    return ret;
+}
+
+bool KalmanStateStore::IsFinite(const int slot) const
+{
+    const BboxXyxy &box = boxes[slot];
+    return !(std::isnan(box.x0) || std::isnan(box.y0) || std::isnan(box.x1) || std::isnan(box.y1));
+}
@@ -0,0 +1,73 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "Types.hpp"
+
+/// @brief 全トラッカーのカルマンフィルタの状態をまとめて保持する。
+/// 状態は (u, v, s, r, du, dv, ds) の7次元、観測は (u, v, s, r) の4次元。
+/// 状態と誤差共分散の各要素をスロット番号で引く配列 (structure of arrays) として持ち、全スロットの予測を要素ごとの
+/// 配列演算としてまとめて行う。スロットは解放後に空きリストから再利用する。
+/// 各スロットのコーナーフォーマットのバウンディングボックスは予測と更新のたびに一度だけ計算してキャッシュする。
+class KalmanStateStore
+{
+public:
+    static const int stateDim = 7;
+    static const int measureDim = 4;
+
+private:
+    int numSlots; // 確保済みのスロット数 (使用中と空きの合計)
+    std::vector<double> states[stateDim];                 // states[i][slot]: 状態変数の i 番目の要素
+    std::vector<double> covariances[stateDim * stateDim]; // covariances[i * stateDim + j][slot]: 誤差の共分散行列
+    std::vector<BboxXyxy> boxes;                          // 状態から求めたバウンディングボックス
+    std::vector<unsigned char> isUsed;
+    std::vector<int> freeSlots;
+
+    std::vector<double> &covariance(const int i, const int j) { return covariances[i * stateDim + j]; }
+    const std::vector<double> &covariance(const int i, const int j) const { return covariances[i * stateDim + j]; }
+    void updateBoxes(const int begin, const int end);
+
+public:
+    KalmanStateStore() : numSlots(0){};
+    ~KalmanStateStore(){};
+
+    /// @brief スロットを確保し、観測値で状態を初期化する
+    /// @return スロット番号
+    int Allocate(const BboxUvsr &bbox);
+    /// @brief スロットを解放する。解放したスロットは次の Allocate で再利用する
+    void Release(const int slot);
+    /// @brief 全てのスロットを解放する
+    void Clear();
+
+    /// @brief 全スロットの状態を次のフレームに進める。空きスロットも含めて配列全体をまとめて計算する
+    /// @param dt 基準のフレーム間隔を 1 とした経過時間。遷移行列と予測ノイズをこれに合わせてスケールする
+    void PredictAll(const double dt = 1.0);
+    /// @brief 1つのスロットの状態を次のフレームに進める
+    void Predict(const int slot, const double dt = 1.0);
+    /// @brief 1つのスロットの状態を観測値で更新する
+    /// @param noiseScale 観測ノイズの倍率。検出より不確かな観測 (オプティカルフローなど) では 1 より大きくする
+    void Update(const int slot, const BboxUvsr &bbox, const double noiseScale = 1.0);
+
+    /// @brief 確保済みのスロット数。スロット番号はこれより小さい
+    int NumSlots() const { return numSlots; }
+    bool IsUsed(const int slot) const { return isUsed[slot] != 0; }
+
+    BboxUvsr GetBbox(const int slot) const;
+    /// @brief キャッシュしたコーナーフォーマットのバウンディングボックス (confidence は 0)
+    const BboxXyxy &GetXyxy(const int slot) const { return boxes[slot]; }
+    /// @brief バウンディングボックスが nan を含まないかどうか
+    bool IsFinite(const int slot) const;
+    /// @brief 中心位置の分散 (u と v の分散の和)。予測だけを続けると大きくなる
+    double GetPositionVariance(const int slot) const { return covariance(0, 0)[slot] + covariance(1, 1)[slot]; }
+    double GetVelocityU(const int slot) const { return states[4][slot]; }
+    double GetVelocityV(const int slot) const { return states[5][slot]; }
+};
@@ -6,364 +6,173 @@
  * electronic, mechanical, photocopying, recording, or otherwise,
  * without the prior consent of Safie Inc.
  */
-
 #include "LinearSumAssignment.hpp"
-#include <cfloat> // dblmax
-#include <cmath>  // fabs()
-
-LinearSumAssignment::LinearSumAssignment(const cv::Mat m) : mat(m), coveredCols(m.cols, false), coveredRows(m.rows, false)
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+/// @brief row から始まり、未割当の列で終わる最短の増加路を探す
+/// @param[out] minVal 見つけた増加路の長さ
+/// @retval 増加路の終点の列。見つからない場合は -1
+int LinearSumAssignment::augmentingPath(const double *cost, const int nrows, const int ncols, int row,
+                                        double &minVal)
 {
-    nrows = m.rows;
-    ncols = m.cols;
-
-    starMat = cv::Mat::zeros(nrows, ncols, CV_8U);
-    primeMat = cv::Mat::zeros(nrows, ncols, CV_8U);
-    if (nrows <= ncols)
-    {
-        isRowBigThanCol = false;
-        minDim = nrows;
-    }
-    else
-    {
-        isRowBigThanCol = true;
-        minDim = ncols;
-    }
-}
+    const double infinity = std::numeric_limits<double>::infinity();
 
-/// @brief 線形割当 (Hungarian Algorithm) の実行
-/// @retval 線形割当のマッチング結果。行列の番号が格納されたリスト。
-void LinearSumAssignment::ComputeAssociation(std::list<RowCol> &association)
-{
-    step1();
-    // bool is_finish = false;
-    bool isFirst = true;
-    bool skip235 = false;
-    while (1)
+    // 未訪問の列。同じ長さの候補からは番号の小さい列を選ぶよう逆順に並べる
+    int numRemaining = ncols;
+    for (int i = 0; i < ncols; i++)
     {
-        if (!skip235)
-        {
-            step2(isFirst);
-            isFirst = false;
-            if (step3())
-            {
-                break;
-            };
-        }
-        skip235 = step4();
-        if (!skip235)
-        {
-            step5();
-        }
-        else
-        {
-            step6();
-        }
+        remaining[i] = ncols - i - 1;
     }
-    putStMat2Vec(association);
-}
+    std::fill(isRowVisited.begin(), isRowVisited.begin() + nrows, 0);
+    std::fill(isColVisited.begin(), isColVisited.begin() + ncols, 0);
+    std::fill(shortestPathCosts.begin(), shortestPathCosts.begin() + ncols, infinity);
 
-/// @brief 行の最小値を探し出し、各要素から引く
-void LinearSumAssignment::step1()
-{
-    if (isRowBigThanCol)
-    {
-        mat = mat.t();
-    }
-    double minVal;
-    // step1: 行の中から最小値を探し、その値を行の要素から引く
-    for (int r = 0; r < mat.rows; r++)
-    {
-        // 最小値の探し出し
-        minVal = mat.at<double>(r, 0);
-        for (int c = 0; c < mat.cols; c++)
-        {
-            double v = mat.at<double>(r, c);
-            if (v < minVal)
-            {
-                minVal = v;
-            }
-        }
-        // 最小値を引く
-        for (int c = 0; c < mat.cols; c++)
-        {
-            mat.at<double>(r, c) = mat.at<double>(r, c) - minVal;
-        }
-    }
-    if (isRowBigThanCol)
+    minVal = 0.0;
+    int sink = -1;
+    while (sink == -1)
     {
-        mat = mat.t();
-    }
-}
+        isRowVisited[row] = 1;
 
-/// @brief Star Zeroを作成する
-/// @param isFirst 1回目かどうかのフラグ
-void LinearSumAssignment::step2(const bool isFirst)
-{
-    // step2a: 各列の最初の0を Star Zero として定義する
-    for (int r = 0; r < nrows; r++)
-    {
-        for (int c = 0; c < ncols; c++)
+        // 訪問した行から未訪問の列までの距離を更新し、最も近い列を選ぶ。同じ距離なら未割当の列を優先する
+        int index = -1;
+        double lowest = infinity;
+        const double *costRow = cost + (size_t)row * ncols;
+        for (int i = 0; i < numRemaining; i++)
         {
-            if (!isFirst)
+            const int col = remaining[i];
+            const double reducedCost = minVal + costRow[col] - u[row] - v[col];
+            if (reducedCost < shortestPathCosts[col])
             {
-                if (starMat.at<unsigned char>(r, c))
-                {
-                    coveredCols[c] = true;
-                    break;
-                }
+                path[col] = row;
+                shortestPathCosts[col] = reducedCost;
             }
-            else
+            if (shortestPathCosts[col] < lowest || (shortestPathCosts[col] == lowest && row4col[col] == -1))
             {
-                if (fabs(mat.at<double>(r, c)) < DBL_EPSILON)
-                {
-                    if (!coveredCols[c])
-                    {
-                        starMat.at<unsigned char>(r, c) = 1;
-                        coveredCols[c] = true;
-                        if (isRowBigThanCol)
-                        {
-                            coveredRows[r] = true;
-                        }
-                        break;
-                    }
-                }
+                lowest = shortestPathCosts[col];
+                index = i;
             }
         }
-    }
-    if (isRowBigThanCol)
-    {
-        // 行のフラグは false に
-        for (int r = 0; r < nrows; r++)
+
+        minVal = lowest;
+        if (index == -1 || minVal == infinity) return -1;
+
+        const int col = remaining[index];
+        if (row4col[col] == -1)
         {
-            coveredRows[r] = false;
+            sink = col;
         }
-    }
-}
-
-/// @brief すべての列の covered flag が立てられていれば終了。そうでなければ次のステップへ。
-bool LinearSumAssignment::step3() const
-{
-    int cnt = 0;
-    for (int c = 0; c < ncols; c++)
-    {
-        if (coveredCols[c])
+        else
         {
-            cnt++;
+            row = row4col[col];
         }
+        isColVisited[col] = 1;
+        remaining[index] = remaining[--numRemaining];
     }
-    if (cnt == minDim) // アルゴリズム終了
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    return sink;
 }
 
-/// @brief 行でも列でもcoverされていない0を見つけ、Prime Zeroとする。
-/// このPrime Zeroを含む列にStar Zeroがなかった場合はstep5へ。
-/// そうでなければ行をcoverし列をuncoverする。
-bool LinearSumAssignment::step4()
+bool LinearSumAssignment::Solve(const double *cost, const int nrows, const int ncols, std::vector<RowCol> &association)
 {
-    bool zerosFlg = false;
-    for (int c = 0; c < ncols; c++)
+    association.clear();
+    if (nrows == 0 || ncols == 0) return true;
+
+    // 行数 <= 列数となる向きで解く
+    const bool isTransposed = nrows > ncols;
+    const int nr = isTransposed ? ncols : nrows;
+    const int nc = isTransposed ? nrows : ncols;
+    if (isTransposed)
     {
-        if (coveredCols[c])
-        {
-            continue;
-        }
+        transposed.resize((size_t)nrows * ncols);
         for (int r = 0; r < nrows; r++)
         {
-            if ((!coveredRows[r]) && (fabs(mat.at<double>(r, c)) < DBL_EPSILON))
+            for (int c = 0; c < ncols; c++)
             {
-                // 行、列ともにCoverされていない0に対しPrime Zeroの作成
-                primeMat.at<unsigned char>(r, c) = 1;
-
-                int starCol;
-                // 現在の列でStar Zeroを探す
-                starCol = findInMat(starMat, r, false);
-
-                // Star Zeroが列になければ
-                if (starCol == -1)
-                {
-                    currRow = r;
-                    currCol = c;
-                    return false;
-                }
-                else
-                {
-                    coveredRows[r] = true;
-                    coveredCols[starCol] = false;
-                    zerosFlg = true;
-                    break;
-                }
+                transposed[(size_t)c * nrows + r] = cost[(size_t)r * ncols + c];
             }
         }
+        cost = transposed.data();
     }
-    if (zerosFlg)
-    {
-        return step4();
-    }
-    else
-    {
-        return true;
-    }
-}
-
-/// @brief step4で見つけたPrime Zeroに対し同じ列のStar Zeroを探し出す。
-/// 見つけたStar Zeroと同じ行のPrime Zeroを探し出す。
-/// 同じ列にStar ZeroがないPrime Zeroが見つかるまで繰り返す。
-/// Star Zero のStarを外し、Prime ZeroをStar Zeroとする。
-/// 全Prime Zeroをなくし、行のCoveredフラグをなくす。
-void LinearSumAssignment::step5()
-{
-    cv::Mat starMatTmp;
-    starMatTmp = cv::Mat::zeros(nrows, ncols, CV_8U);
-    // Star Zeroを更新するためのテンポラリ行列の作成
-    for (int r = 0; r < nrows; r++)
-    {
-        for (int c = 0; c < ncols; c++)
-        {
-            starMatTmp.at<unsigned char>(r, c) = starMat.at<unsigned char>(r, c);
-        }
-    }
-    // 現在のPrime Zeroを次期Star Zeroに
-    starMatTmp.at<unsigned char>(currRow, currCol) = 1;
-    // 同列のStarZeroを探す
-    int starRow;
-    int starCol = currCol;
-    starRow = findInMat(starMat, starCol, true);
-    while (starRow != -1)
-    {
-        // Star Zeroのフラグを外す
-        starMatTmp.at<unsigned char>(starRow, starCol) = 0;
 
-        // 同行のPrime Zeroを探す
-        int primeCol;
-        int primeRow = starRow;
-        primeCol = findInMat(primeMat, primeRow, false);
-        // Prime ZeroをStar Zeroにする
-        starMatTmp.at<unsigned char>(primeRow, primeCol) = 1;
+    u.assign(nr, 0.0);
+    v.assign(nc, 0.0);
+    shortestPathCosts.resize(nc);
+    path.assign(nc, -1);
+    col4row.assign(nr, -1);
+    row4col.assign(nc, -1);
+    isRowVisited.resize(nr);
+    isColVisited.resize(nc);
+    remaining.resize(nc);
 
-        // 同列のStar Zeroを探す
-        starCol = primeCol;
-        starRow = findInMat(starMat, starCol, true);
-    }
-    // Prime Zeroを0に
-    // Star Zeroを更新
-    // 行のCoverをなくす
-    for (int r = 0; r < nrows; r++)
+    for (int currRow = 0; currRow < nr; currRow++)
     {
-        for (int c = 0; c < ncols; c++)
+        double minVal;
+        const int sink = augmentingPath(cost, nr, nc, currRow, minVal);
+        if (sink < 0)
         {
-            primeMat.at<unsigned char>(r, c) = 0;
-            starMat.at<unsigned char>(r, c) = starMatTmp.at<unsigned char>(r, c);
+            std::cerr << "Linear sum assignment is infeasible" << std::endl;
+            return false;
         }
-        coveredRows[r] = false;
-    }
-    return;
-}
 
-/// @brief 行列ともにCoverされていない要素の最小値を探しだし
-/// Coverされている列の値には足す。
-/// Coverされていない行の値からは引く。
-void LinearSumAssignment::step6()
-{
-    double minVal, v;
-
-    // 行列ともにCoverされていない要素の最小値を探す
-    minVal = DBL_MAX;
-    for (int r = 0; r < nrows; r++)
-    {
-        if (coveredRows[r])
+        // 双対変数を更新する
+        u[currRow] += minVal;
+        for (int r = 0; r < nr; r++)
         {
-            continue;
+            if (isRowVisited[r] && r != currRow)
+            {
+                u[r] += minVal - shortestPathCosts[col4row[r]];
+            }
         }
-        for (int c = 0; c < ncols; c++)
+        for (int c = 0; c < nc; c++)
         {
-            if (!coveredCols[c])
+            if (isColVisited[c])
             {
-                v = mat.at<double>(r, c);
-                if (v < minVal)
-                {
-                    minVal = v;
-                }
+                v[c] -= minVal - shortestPathCosts[c];
             }
         }
-    }
 
-    // Coverされている行の値には足す
-    // Coverされていない列の値からは引く
-    for (int r = 0; r < nrows; r++)
-    {
-        for (int c = 0; c < ncols; c++)
+        // 増加路に沿って割当を入れ替える
+        int col = sink;
+        while (true)
         {
-            if (coveredRows[r])
-            {
-                mat.at<double>(r, c) += minVal;
-            }
-            if (!coveredCols[c])
-            {
-                mat.at<double>(r, c) -= minVal;
-            }
+            const int row = path[col];
+            row4col[col] = row;
+            std::swap(col4row[row], col);
+            if (row == currRow) break;
         }
     }
 
-    return;
-}
-
-/// @brief 行列から値を探す関数
-/// @param m 探す対象の行列
-/// @param c 探す行または列
-/// @param isRow 行を探すかどうかのフラグ。falseだったら列を探す。
-/// @retval 見つけた行または列
-int LinearSumAssignment::findInMat(const cv::Mat m, const int c, const bool isRow)
-{
-    int n = -1;
-    int size;
-    if (isRow)
+    association.resize(nr);
+    if (isTransposed)
     {
-        size = m.rows;
-        for (int i = 0; i < size; i++)
+        // 元の行番号の昇順に並べる
+        int n = 0;
+        for (int c = 0; c < nc; c++)
         {
-            if (m.at<unsigned char>(i, c))
-            {
-                n = i;
-            }
+            if (row4col[c] == -1) continue;
+            association[n].row = c;
+            association[n].col = row4col[c];
+            n++;
         }
     }
     else
     {
-        size = m.cols;
-        for (int i = 0; i < size; i++)
+        for (int r = 0; r < nr; r++)
         {
-            if (m.at<unsigned char>(c, i))
-            {
-                n = i;
-            }
+            association[r].row = r;
+            association[r].col = col4row[r];
         }
     }
-    return n;
+    return true;
 }
 
-/// @brief starMat行列の値をリストに格納して返す
-/// @param[out] res 結果を格納するRowCol構造体型のリスト
-void LinearSumAssignment::putStMat2Vec(std::list<RowCol> &res) const
+bool LinearSumAssignment::Solve(const cv::Mat &cost, std::vector<RowCol> &association)
 {
-    for (int r = 0; r < nrows; r++)
+    if (cost.type() != CV_64F || !cost.isContinuous())
     {
-        for (int c = 0; c < ncols; c++)
-        {
-            if (starMat.at<unsigned char>(r, c))
-            {
-                RowCol tmpRes;
-                tmpRes.row = r;
-                tmpRes.col = c;
-
-                res.push_back(tmpRes);
-                break;
-            }
-        }
+        std::cerr << "Cost matrix must be a continuous CV_64F matrix" << std::endl;
+        return false;
     }
+    return Solve(cost.ptr<double>(0), cost.rows, cost.cols, association);
 }
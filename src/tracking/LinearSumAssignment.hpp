@@ -8,40 +8,47 @@
  */
 #pragma once
 
-#include <list>
 #include <opencv2/opencv.hpp>
 #include <vector>
-/// @brief 線形割当 (Hungarian Algorithm) の結果を行番号列番号で格納する構造体
+/// @brief 線形割当の結果を行番号列番号で格納する構造体
 struct RowCol
 {
     int row;
     int col;
 };
 
-/// @brief Hungarian algorithm を用いて linear sum assignment を行う
+/// @brief 最短増加路法 (Jonker-Volgenant 法の系統) を用いて linear sum assignment を行う。
+/// 行を1つずつ追加し、双対変数で非負にした被約コストの上でダイクストラ法により増加路を探して割当を広げる。
+/// 計算量は O(n^2 m) (n = min(行数, 列数)、m = max(行数, 列数))。
+/// 作業領域はメンバーに持ち、呼び出しごとに使い回す。長方形のコスト行列は行数が列数以下になるよう転置して解く。
 class LinearSumAssignment
 {
 private:
-    cv::Mat mat, dist, starMat, primeMat;
-
-    int nrows, ncols, minDim, currRow, currCol;
-
-    std::vector<bool> coveredCols, coveredRows;
-
-    bool isRowBigThanCol;
-
-    void putStMat2Vec(std::list<RowCol> &res) const;
-    void step1();
-    void step2(const bool isFirst);
-    bool step3() const;
-    bool step4();
-    void step5();
-    void step6();
-    int findInMat(const cv::Mat m, const int c, const bool isRow);
+    // 作業領域 (行数 <= 列数の向きで持つ)
+    std::vector<double> transposed; // 行数が列数より多い場合に転置したコスト行列
+    std::vector<double> u;          // 行の双対変数
+    std::vector<double> v;          // 列の双対変数
+    std::vector<double> shortestPathCosts;
+    std::vector<int> path;
+    std::vector<int> col4row;
+    std::vector<int> row4col;
+    std::vector<unsigned char> isRowVisited;
+    std::vector<unsigned char> isColVisited;
+    std::vector<int> remaining;
+
+    int augmentingPath(const double *cost, const int nrows, const int ncols, int row, double &minVal);
 
 public:
-    LinearSumAssignment(const cv::Mat m);
+    LinearSumAssignment(){};
     ~LinearSumAssignment(){};
 
-    void ComputeAssociation(std::list<RowCol> &association);
+    /// @brief コストの総和が最小となる割当を求める
+    /// @param cost 行優先で並べた nrows x ncols のコスト行列
+    /// @param[out] association 割当の結果。行番号の昇順に min(nrows, ncols) 個の組を格納する
+    /// @retval コストに nan や無限大が含まれ、割当が求まらない場合は false
+    bool Solve(const double *cost, const int nrows, const int ncols, std::vector<RowCol> &association);
+
+    /// @brief コストの総和が最小となる割当を求める
+    /// @param cost CV_64F のコスト行列
+    bool Solve(const cv::Mat &cost, std::vector<RowCol> &association);
 };
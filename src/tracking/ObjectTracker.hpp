@@ -11,17 +11,20 @@
 #include <deque>
 
 #include "BboxUtil.hpp"
+#include "KalmanStateStore.hpp"
 
 
 /// @brief カルマンフィルタを用いたオブジェクトトラッカー
+/// カルマンフィルタの状態は KalmanStateStore のスロットに置き、トラッカーはスロット番号と追跡状態を持つ。
+/// トラッカーのコピーは同じスロットを指す。スロットの解放は所有者 (Byte) が明示的に行う。
 class ObjectTracker
 {
 private:
-    cv::Mat x, z;
-    cv::Mat F, H, R, Q, P;
-    cv::Mat e, K;
+    KalmanStateStore *states;
+    int slot;
 
     int numFrameDropped;   // 検出できていないフレーム数
+    double timeDropped;    // 検出できていない時間 (基準のフレーム間隔を 1 とする)
     int numFrameSustained; // 連続で検出できているフレーム
     int numInitialFrame;   // 連続検出の条件をスキップする初期フレーム数
     int minFrameSustained; // 何フレーム以上連続で検出された場合に可視化状態になる
@@ -30,29 +33,44 @@ private:
     bool isHidden;       // 公開していないトラックレット
     double confidence;
 
-    void adjustScale();
-
 public:
-    ObjectTracker(){};
-    ObjectTracker(const BboxUvsr bbox, const int numInitialFrame, const int minFrameSustained, const int id);
-    ObjectTracker(const BboxUvsr bbox, const int numInitialFrame, const int minFrameSustained, const int id,
-                  const double confidence);
+    ObjectTracker() : states(nullptr), slot(-1){};
+    ObjectTracker(KalmanStateStore &states, const BboxUvsr bbox, const int numInitialFrame,
+                  const int minFrameSustained, const int id);
+    ObjectTracker(KalmanStateStore &states, const BboxUvsr bbox, const int numInitialFrame,
+                  const int minFrameSustained, const int id, const double confidence);
     ~ObjectTracker(){};
 
     // Getter
     BboxUvsr GetBbox() const;
+    /// @brief キャッシュしたコーナーフォーマットのバウンディングボックス
+    const BboxXyxy &GetXyxy() const { return states->GetXyxy(slot); }
+    int GetSlot() const { return slot; }
+    double GetPositionVariance() const { return states->GetPositionVariance(slot); }
     double GetSpeed() const;
     double GetConfidence() const { return confidence; };
     cv::Vec2d GetVelocity() const;
     int GetId() const;
     int NumFrameSustained() const;
     int NumFrameDropped() const;
+    double TimeDropped() const { return timeDropped; }
     bool IsMatchedTrackVisible(const int currFrame);
     bool IsVisibleSoFar() const;
 
     void Reveal();
     void Update(const BboxUvsr bbox);
+    /// @brief 検出以外の観測 (オプティカルフローなど) でカルマンフィルタを更新する。
+    /// 検出できていないフレーム数と時間、連続検出のフレーム数は変えない
+    /// @param noiseScale 検出に対する観測ノイズの倍率
+    void Correct(const BboxUvsr bbox, const double noiseScale) { states->Update(slot, bbox, noiseScale); }
     void UpdateConfidence(const double confidence) { this->confidence = confidence; }
-    void Predict();
+    void Predict(const double dt = 1.0);
+    /// @brief 予測に伴う追跡状態だけを進める。状態の予測は KalmanStateStore::PredictAll でまとめて行う
+    /// @param dt 基準のフレーム間隔を 1 とした経過時間
+    void AdvanceFrame(const double dt = 1.0);
+    /// @brief 検出を行わないフレームの予測で、検出できていない時間だけを進める。
+    /// 検出できていないフレーム数と連続検出のフレーム数は変えない
+    /// @param dt 基準のフレーム間隔を 1 とした経過時間
+    void AdvanceTime(const double dt) { timeDropped += dt; }
     bool IsUpdated() const;
 };
@@ -0,0 +1,152 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "Letterbox.hpp"
+#include "SimdUtil.hpp"
+
+#include <cassert>
+#include <cmath>
+
+/// @brief OpenCV の INTER_LINEAR と同じ規則で、出力画素に対応する入力画素のインデックスと重みを求める
+static void calcLinearTable(const int srcSize, const int dstSize, std::vector<int> &indices, std::vector<float> &weights)
+{
+    const double scale = (double)srcSize / (double)dstSize;
+    indices.resize(2 * dstSize);
+    weights.resize(2 * dstSize);
+    for (int d = 0; d < dstSize; d++)
+    {
+        float f = (float)((d + 0.5) * scale - 0.5);
+        int s = (int)std::floor(f);
+        f -= (float)s;
+        if (s < 0)
+        {
+            s = 0;
+            f = 0.0f;
+        }
+        if (s >= srcSize - 1)
+        {
+            s = srcSize - 1;
+            f = 0.0f;
+        }
+        indices[2 * d] = s;
+        indices[2 * d + 1] = std::min(s + 1, srcSize - 1);
+        weights[2 * d] = 1.0f - f;
+        weights[2 * d + 1] = f;
+    }
+}
+
+Letterbox::Letterbox()
+    : srcWidth(0), srcHeight(0), dstWidth(0), dstHeight(0), ratio(1.0f), resizedWidth(0), resizedHeight(0), padLeft(0),
+      padTop(0), padValue(128.0f / 255.0f)
+{
+    bufferedRows[0] = -1;
+    bufferedRows[1] = -1;
+}
+
+void Letterbox::Configure(const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight)
+{
+    if (srcWidth == this->srcWidth && srcHeight == this->srcHeight && dstWidth == this->dstWidth &&
+        dstHeight == this->dstHeight)
+    {
+        return;
+    }
+    this->srcWidth = srcWidth;
+    this->srcHeight = srcHeight;
+    this->dstWidth = dstWidth;
+    this->dstHeight = dstHeight;
+
+    // resize by keeping aspect ratio
+    ratio = std::min(1.0f * (float)dstWidth / (float)srcWidth, 1.0f * (float)dstHeight / (float)srcHeight);
+    resizedHeight = int((float)srcHeight * ratio);
+    resizedWidth = int((float)srcWidth * ratio);
+
+    // odd number->pad size error
+    if (resizedHeight % 2 != 0) resizedHeight -= 1;
+    if (resizedWidth % 2 != 0) resizedWidth -= 1;
+
+    padLeft = (dstWidth - resizedWidth) / 2;
+    padTop = (dstHeight - resizedHeight) / 2;
+
+    // 水平方向のオフセットは入力行の先頭からのバイト数で持つ
+    std::vector<int> xIndices;
+    calcLinearTable(srcWidth, resizedWidth, xIndices, xWeights);
+    xOffsets.resize(xIndices.size());
+    for (size_t i = 0; i < xIndices.size(); i++)
+    {
+        xOffsets[i] = xIndices[i] * 3;
+    }
+    calcLinearTable(srcHeight, resizedHeight, yIndices, yWeights);
+
+    for (int i = 0; i < 2; i++)
+    {
+        rowBuffers[i].resize(resizedWidth * 3);
+        bufferedRows[i] = -1;
+    }
+}
+
+/// @brief 入力の1行を水平方向に補間し、R/B を入れ替えて out に書き込む
+void Letterbox::interpolateRow(const cv::Mat &src, const int sy, float *out) const
+{
+    const uchar *row = src.ptr<uchar>(sy);
+    const int *ofs = xOffsets.data();
+    const float *w = xWeights.data();
+    for (int dx = 0; dx < resizedWidth; dx++)
+    {
+        const uchar *p0 = row + ofs[2 * dx];
+        const uchar *p1 = row + ofs[2 * dx + 1];
+        const float w0 = w[2 * dx];
+        const float w1 = w[2 * dx + 1];
+        out[3 * dx + 0] = (float)p0[2] * w0 + (float)p1[2] * w1;
+        out[3 * dx + 1] = (float)p0[1] * w0 + (float)p1[1] * w1;
+        out[3 * dx + 2] = (float)p0[0] * w0 + (float)p1[0] * w1;
+    }
+}
+
+/// @brief 水平方向に補間済みの行を返す。直前の出力行で使った行はキャッシュから返すため、入力の各行は一度しか読まない。
+const float *Letterbox::getInterpolatedRow(const cv::Mat &src, const int sy)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (bufferedRows[i] == sy) return rowBuffers[i].data();
+    }
+    // 上の行から順に処理するので、小さい行番号のバッファを置き換える
+    const int slot = (bufferedRows[0] < bufferedRows[1]) ? 0 : 1;
+    interpolateRow(src, sy, rowBuffers[slot].data());
+    bufferedRows[slot] = sy;
+    return rowBuffers[slot].data();
+}
+
+void Letterbox::Run(const cv::Mat &src, float *dst)
+{
+    assert(src.type() == CV_8UC3 && src.cols == srcWidth && src.rows == srcHeight);
+
+    const int dstRowSize = dstWidth * 3;
+    const int leftSize = padLeft * 3;
+    const int resizedRowSize = resizedWidth * 3;
+    const int rightSize = dstRowSize - leftSize - resizedRowSize;
+    const float scale = 1.0f / 255.0f;
+
+    // 上下のパディング
+    SimdUtil::Fill(dst, padValue, padTop * dstRowSize);
+    const int bottomStart = padTop + resizedHeight;
+    SimdUtil::Fill(dst + bottomStart * dstRowSize, padValue, (dstHeight - bottomStart) * dstRowSize);
+
+    bufferedRows[0] = -1;
+    bufferedRows[1] = -1;
+    for (int dy = 0; dy < resizedHeight; dy++)
+    {
+        float *dstRow = dst + (padTop + dy) * dstRowSize;
+        SimdUtil::Fill(dstRow, padValue, leftSize);
+        SimdUtil::Fill(dstRow + leftSize + resizedRowSize, padValue, rightSize);
+
+        const float *row0 = getInterpolatedRow(src, yIndices[2 * dy]);
+        const float *row1 = getInterpolatedRow(src, yIndices[2 * dy + 1]);
+        SimdUtil::BlendRows(row0, row1, yWeights[2 * dy], yWeights[2 * dy + 1], scale, dstRow + leftSize, resizedRowSize);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/// @brief アスペクト比を保ったリサイズ、パディング、R/B チャンネル入れ替え、[0, 1] 正規化を1パスで行う前処理。
+/// cv::resize (INTER_LINEAR) → cv::copyMakeBorder → cv::cvtColor → convertTo → / 255 と同じ結果を、
+/// 中間画像を作らずにネットワーク入力 (NHWC, float) へ直接書き込む。
+/// 固定小数点で丸める OpenCV と異なり浮動小数点で補間するため、画素値の差は最大 1 / 255 程度。
+class Letterbox
+{
+private:
+    int srcWidth;
+    int srcHeight;
+    int dstWidth;
+    int dstHeight;
+
+    float ratio;
+    int resizedWidth;
+    int resizedHeight;
+    int padLeft;
+    int padTop;
+    float padValue; // 正規化後のパディング値
+
+    // 水平方向の補間テーブル。リサイズ後の画素ごとに参照する2画素のオフセットと重み
+    std::vector<int> xOffsets;
+    std::vector<float> xWeights;
+    // 垂直方向の補間テーブル。リサイズ後の行ごとに参照する2行と重み
+    std::vector<int> yIndices;
+    std::vector<float> yWeights;
+
+    // 水平方向に補間済みの入力行のキャッシュ
+    std::vector<float> rowBuffers[2];
+    int bufferedRows[2];
+
+    void interpolateRow(const cv::Mat &src, const int sy, float *out) const;
+    const float *getInterpolatedRow(const cv::Mat &src, const int sy);
+
+public:
+    Letterbox();
+    ~Letterbox(){};
+
+    /// @brief 入出力サイズから変換パラメータと補間テーブルを計算する。サイズが変わらない場合は何もしない。
+    void Configure(const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight);
+
+    /// @brief 前処理を実行する
+    /// @param src CV_8UC3 の入力画像。サイズは Configure() で指定したもの
+    /// @param dst dstHeight x dstWidth x 3 の float 配列
+    void Run(const cv::Mat &src, float *dst);
+
+    float Ratio() const { return ratio; }
+    int PadLeft() const { return padLeft; }
+    int PadTop() const { return padTop; }
+};
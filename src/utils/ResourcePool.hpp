@@ -0,0 +1,81 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// @brief ネットワークなど、複数のスレッドで使い回す数の決まったインスタンスの置き場。
+/// Acquire() で空いているインスタンスを借り、使い終わったら Release() で返す。空きがなければ返されるまで待つ。
+/// 借りている間のインスタンスは1つのスレッドだけが使う
+template <typename T>
+class ResourcePool
+{
+private:
+    std::vector<std::unique_ptr<T>> items;
+    std::vector<T *> freeItems;
+    std::mutex mutex;
+    std::condition_variable released;
+
+public:
+    ResourcePool(){};
+    ~ResourcePool(){};
+    ResourcePool(const ResourcePool &) = delete;
+    ResourcePool &operator=(const ResourcePool &) = delete;
+
+    /// @brief インスタンスを加える。Acquire() を呼ぶスレッドを動かす前に呼ぶ
+    void Add(std::unique_ptr<T> item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeItems.push_back(item.get());
+        items.push_back(std::move(item));
+    }
+
+    size_t Size() const { return items.size(); }
+
+    /// @brief 空いているインスタンスを借りる。空きがなければ返されるまで待つ
+    T *Acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [this]() { return !freeItems.empty(); });
+        T *item = freeItems.back();
+        freeItems.pop_back();
+        return item;
+    }
+
+    /// @brief Acquire() で借りたインスタンスを返す
+    void Release(T *item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeItems.push_back(item);
+        }
+        released.notify_one();
+    }
+
+    /// @brief スコープを抜けるときに返すように借りる
+    class Lease
+    {
+    private:
+        ResourcePool &pool;
+        T *item;
+
+    public:
+        explicit Lease(ResourcePool &pool) : pool(pool), item(pool.Acquire()) {}
+        ~Lease() { pool.Release(item); }
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+
+        T *operator->() const { return item; }
+        T &operator*() const { return *item; }
+    };
+};
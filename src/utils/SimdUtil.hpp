@@ -0,0 +1,183 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/// @brief SIMD 命令を用いた配列演算のユーティリティ。x86-64 では SSE2、aarch64 では NEON を使い、端数はスカラーで処理する。
+namespace SimdUtil
+{
+    /// @brief 2つの行を重み付きで足し合わせ、スケールを掛ける。dst[i] = (a[i] * wa + b[i] * wb) * scale
+    inline void BlendRows(const float *a, const float *b, const float wa, const float wb, const float scale, float *dst,
+                          const int n)
+    {
+        const float ka = wa * scale;
+        const float kb = wb * scale;
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128 va = _mm_set1_ps(ka);
+        const __m128 vb = _mm_set1_ps(kb);
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), va), _mm_mul_ps(_mm_loadu_ps(b + i), vb));
+            _mm_storeu_ps(dst + i, sum);
+        }
+#elif defined(__ARM_NEON)
+        const float32x4_t va = vdupq_n_f32(ka);
+        const float32x4_t vb = vdupq_n_f32(kb);
+        for (; i + 4 <= n; i += 4)
+        {
+            vst1q_f32(dst + i, vmlaq_f32(vmulq_f32(vld1q_f32(a + i), va), vld1q_f32(b + i), vb));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] = a[i] * ka + b[i] * kb;
+        }
+    }
+
+    /// @brief 配列を定数で埋める
+    inline void Fill(float *dst, const float value, const int n)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128 v = _mm_set1_ps(value);
+        for (; i + 4 <= n; i += 4)
+        {
+            _mm_storeu_ps(dst + i, v);
+        }
+#elif defined(__ARM_NEON)
+        const float32x4_t v = vdupq_n_f32(value);
+        for (; i + 4 <= n; i += 4)
+        {
+            vst1q_f32(dst + i, v);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] = value;
+        }
+    }
+
+    /// @brief 定数倍した配列を足し込む。dst[i] += src[i] * scale
+    inline void AccumulateScaled(double *dst, const double *src, const double scale, const int n)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128d vs = _mm_set1_pd(scale);
+        for (; i + 2 <= n; i += 2)
+        {
+            _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), _mm_mul_pd(_mm_loadu_pd(src + i), vs)));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float64x2_t vs = vdupq_n_f64(scale);
+        for (; i + 2 <= n; i += 2)
+        {
+            vst1q_f64(dst + i, vaddq_f64(vld1q_f64(dst + i), vmulq_f64(vld1q_f64(src + i), vs)));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] += src[i] * scale;
+        }
+    }
+
+    /// @brief src[i] >= threshold を満たすインデックスを昇順に indices の末尾へ追加する。
+    /// 閾値を超える要素が疎な配列を高速に走査するためのもの。
+    inline void FindGreaterEqual(const float *src, const int n, const float threshold, std::vector<int> &indices)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128 vt = _mm_set1_ps(threshold);
+        for (; i + 4 <= n; i += 4)
+        {
+            int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(src + i), vt));
+            while (mask != 0)
+            {
+                const int bit = __builtin_ctz(mask);
+                indices.push_back(i + bit);
+                mask &= mask - 1;
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t vt = vdupq_n_f32(threshold);
+        for (; i + 4 <= n; i += 4)
+        {
+            if (vmaxvq_u32(vcgeq_f32(vld1q_f32(src + i), vt)) == 0) continue;
+            for (int j = i; j < i + 4; j++)
+            {
+                if (src[j] >= threshold) indices.push_back(j);
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (src[i] >= threshold) indices.push_back(i);
+        }
+    }
+
+    /// @brief 最大値とそのインデックスを求める。最大値が複数ある場合は最初のインデックスを返す (std::max_element と同じ)。
+    /// n は 1 以上とする。
+    inline int ArgMax(const float *src, const int n, float &maxValue)
+    {
+        // 1パス目で最大値を求め、2パス目で最大値と等しい最初の要素を探す
+        float m = src[0];
+        int i = 0;
+#if defined(__SSE2__)
+        if (n >= 4)
+        {
+            __m128 vm = _mm_loadu_ps(src);
+            for (i = 4; i + 4 <= n; i += 4)
+            {
+                vm = _mm_max_ps(vm, _mm_loadu_ps(src + i));
+            }
+            vm = _mm_max_ps(vm, _mm_shuffle_ps(vm, vm, _MM_SHUFFLE(2, 3, 0, 1)));
+            vm = _mm_max_ps(vm, _mm_shuffle_ps(vm, vm, _MM_SHUFFLE(1, 0, 3, 2)));
+            m = _mm_cvtss_f32(vm);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        if (n >= 4)
+        {
+            float32x4_t vm = vld1q_f32(src);
+            for (i = 4; i + 4 <= n; i += 4)
+            {
+                vm = vmaxq_f32(vm, vld1q_f32(src + i));
+            }
+            m = vmaxvq_f32(vm);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (src[i] > m) m = src[i];
+        }
+        maxValue = m;
+
+        i = 0;
+#if defined(__SSE2__)
+        const __m128 vmax = _mm_set1_ps(m);
+        for (; i + 4 <= n; i += 4)
+        {
+            const int mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(src + i), vmax));
+            if (mask != 0) return i + __builtin_ctz(mask);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (src[i] == m) return i;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#include "SnpeIoBuffers.hpp"
+#include "SnpeUtil.hpp"
+
+#include <iostream>
+
+#include "DlSystem/IBufferAttributes.hpp"
+#include "DlSystem/IUserBufferFactory.hpp"
+#include "DlSystem/TensorShape.hpp"
+#include "SNPE/SNPEFactory.hpp"
+
+static std::vector<size_t> toDims(const zdl::DlSystem::TensorShape &shape)
+{
+    std::vector<size_t> dims(shape.rank());
+    for (size_t i = 0; i < shape.rank(); i++)
+    {
+        dims[i] = shape[i];
+    }
+    return dims;
+}
+
+// This method is based on the SNPE sample: $SNPE_ROOT/examples/SNPE/NativeCpp/SampleCode/jni/CreateUserBuffer.cpp
+bool SnpeIoBuffers::createUserBuffer(std::unique_ptr<zdl::SNPE::SNPE> &snpe, const std::string &name,
+                                     zdl::DlSystem::UserBufferMap &userBufferMap, std::vector<size_t> &dims)
+{
+    auto bufferAttributesOpt = snpe->getInputOutputBufferAttributes(name.c_str());
+    if (!bufferAttributesOpt)
+    {
+        std::cerr << "Error obtaining attributes for tensor: " << name << std::endl;
+        return false;
+    }
+    dims = toDims((*bufferAttributesOpt)->getDims());
+
+    // float の NHWC 配列として連続に並べたときのストライド (bytes)
+    std::vector<size_t> strides(dims.size());
+    size_t stride = sizeof(float);
+    for (size_t i = dims.size(); i > 0; i--)
+    {
+        strides[i - 1] = stride;
+        stride *= dims[i - 1];
+    }
+    const size_t bufferSize = stride;
+
+    std::vector<float> &data = userBufferData[name];
+    data.assign(bufferSize / sizeof(float), 0.0f);
+
+    zdl::DlSystem::UserBufferEncodingFloat userBufferEncodingFloat;
+    zdl::DlSystem::IUserBufferFactory &ubFactory = zdl::SNPE::SNPEFactory::getUserBufferFactory();
+    userBuffers.push_back(ubFactory.createUserBuffer(data.data(), bufferSize,
+                                                     zdl::DlSystem::TensorShape(strides.data(), strides.size()),
+                                                     &userBufferEncodingFloat));
+    if (userBuffers.back() == nullptr)
+    {
+        std::cerr << "Error while creating user buffer: " << name << std::endl;
+        return false;
+    }
+    userBufferMap.add(name.c_str(), userBuffers.back().get());
+    return true;
+}
+
+bool SnpeIoBuffers::Create(std::unique_ptr<zdl::SNPE::SNPE> &snpe, const bool isUserBufferMode)
+{
+    this->isUserBufferMode = isUserBufferMode;
+
+    const auto &inputNamesOpt = snpe->getInputTensorNames();
+    const auto &outputNamesOpt = snpe->getOutputTensorNames();
+    if (!inputNamesOpt || !outputNamesOpt)
+    {
+        std::cerr << "Error obtaining tensor names" << std::endl;
+        return false;
+    }
+    const zdl::DlSystem::StringList &inputNames = *inputNamesOpt;
+    const zdl::DlSystem::StringList &outputNames = *outputNamesOpt;
+    // Make sure the network requires only a single input
+    if (inputNames.size() != 1)
+    {
+        std::cerr << "Network must have a single input" << std::endl;
+        return false;
+    }
+    inputName = inputNames.at(0);
+
+    if (!isUserBufferMode)
+    {
+        inputTensor = SnpeUtil::createInputTensor(snpe);
+        inputDims = toDims(inputTensor->getShape());
+        return true;
+    }
+
+    if (!createUserBuffer(snpe, inputName, inputMap, inputDims)) return false;
+    for (size_t i = 0; i < outputNames.size(); i++)
+    {
+        const std::string outputName = outputNames.at(i);
+        if (!createUserBuffer(snpe, outputName, outputMap, outputDims[outputName])) return false;
+    }
+    return true;
+}
+
+bool SnpeIoBuffers::Execute(std::unique_ptr<zdl::SNPE::SNPE> &snpe)
+{
+    if (isUserBufferMode)
+    {
+        return snpe->execute(inputMap, outputMap);
+    }
+
+    outputTensorMap.clear();
+    if (!snpe->execute(inputTensor.get(), outputTensorMap)) return false;
+
+    const zdl::DlSystem::StringList names = outputTensorMap.getTensorNames();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        outputDims[names.at(i)] = toDims(outputTensorMap.getTensor(names.at(i))->getShape());
+    }
+    return true;
+}
+
+float *SnpeIoBuffers::Input()
+{
+    if (isUserBufferMode)
+    {
+        return userBufferData.at(inputName).data();
+    }
+    return &(*inputTensor->begin());
+}
+
+const float *SnpeIoBuffers::Output(const std::string &name) const
+{
+    if (isUserBufferMode)
+    {
+        return userBufferData.at(name).data();
+    }
+    zdl::DlSystem::ITensor *tensor = outputTensorMap.getTensor(name.c_str());
+    if (tensor == nullptr) return nullptr;
+    return &(*tensor->cbegin());
+}
+
+const std::vector<size_t> &SnpeIoBuffers::OutputDims(const std::string &name) const
+{
+    const auto it = outputDims.find(name);
+    if (it == outputDims.end()) return emptyDims;
+    return it->second;
+}
@@ -0,0 +1,66 @@
+/*
+ * (c) 2024 Safie Inc.
+ *
+ * NOTICE: No part of this file may be reproduced, stored
+ * in a retrieval system, or transmitted, in any form, or by any means,
+ * electronic, mechanical, photocopying, recording, or otherwise,
+ * without the prior consent of Safie Inc.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DlSystem/IUserBuffer.hpp"
+#include "DlSystem/TensorMap.hpp"
+#include "DlSystem/UserBufferMap.hpp"
+#include "SNPE/SNPE.hpp"
+
+/// @brief SNPE ネットワーク1つ分の入出力バッファ。ネットワークの構築後に一度だけ確保し、推論ごとに使い回す。
+/// ユーザーバッファモード (setUseUserSuppliedBuffers(true) で構築したネットワーク) では入出力とも UserBufferMap
+/// を使うため、定常状態でメモリ確保が発生しない。ITensor モードでは入力テンソルのみ使い回す。
+class SnpeIoBuffers
+{
+private:
+    bool isUserBufferMode;
+
+    std::string inputName;
+    std::vector<size_t> inputDims;
+    std::map<std::string, std::vector<size_t>> outputDims;
+    const std::vector<size_t> emptyDims;
+
+    // ITensor モード
+    std::unique_ptr<zdl::DlSystem::ITensor> inputTensor;
+    zdl::DlSystem::TensorMap outputTensorMap;
+
+    // ユーザーバッファモード
+    zdl::DlSystem::UserBufferMap inputMap;
+    zdl::DlSystem::UserBufferMap outputMap;
+    std::vector<std::unique_ptr<zdl::DlSystem::IUserBuffer>> userBuffers;
+    std::map<std::string, std::vector<float>> userBufferData;
+
+    bool createUserBuffer(std::unique_ptr<zdl::SNPE::SNPE> &snpe, const std::string &name,
+                          zdl::DlSystem::UserBufferMap &userBufferMap, std::vector<size_t> &dims);
+
+public:
+    SnpeIoBuffers() : isUserBufferMode(false){};
+    ~SnpeIoBuffers(){};
+
+    /// @brief 入出力バッファを確保する
+    /// @param isUserBufferMode ネットワークを setUseUserSuppliedBuffers(true) で構築した場合は true
+    bool Create(std::unique_ptr<zdl::SNPE::SNPE> &snpe, const bool isUserBufferMode);
+
+    /// @brief 推論を実行する。入力は Input() に書き込んでおく。
+    bool Execute(std::unique_ptr<zdl::SNPE::SNPE> &snpe);
+
+    /// @brief 入力バッファの先頭。前処理の結果を直接書き込む。
+    float *Input();
+    const std::vector<size_t> &InputDims() const { return inputDims; }
+
+    /// @brief 出力バッファの先頭。Execute() の後、次の Execute() まで有効。
+    const float *Output(const std::string &name) const;
+    const std::vector<size_t> &OutputDims(const std::string &name) const;
+};
@@ -29,6 +29,19 @@ std::unique_ptr<zdl::DlContainer::IDlContainer> SnpeUtil::loadContainerFromBuffe
     return container;
 }
 
+std::unique_ptr<zdl::DlSystem::ITensor> SnpeUtil::createInputTensor(std::unique_ptr<zdl::SNPE::SNPE> &snpe)
+{
+    const auto &strList_opt = snpe->getInputTensorNames();
+    if (!strList_opt) throw std::runtime_error("Error obtaining Input tensor names");
+    const auto &strList = *strList_opt;
+    // Make sure the network requires only a single input
+    assert(strList.size() == 1);
+
+    const auto &inputDims_opt = snpe->getInputDimensions(strList.at(0));
+    const auto &inputShape = *inputDims_opt;
+    return zdl::SNPE::SNPEFactory::getTensorFactory().createTensor(inputShape);
+}
+
 // This method is based on the SNPE sample: $SNPE_ROOT/examples/SNPE/NativeCpp/SampleCode/jni/LoadInputTensor.cpp
 std::unique_ptr<zdl::DlSystem::ITensor> SnpeUtil::loadInputTensor(std::unique_ptr<zdl::SNPE::SNPE> &snpe, cv::Mat inputImage)
 {
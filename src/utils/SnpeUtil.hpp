@@ -24,6 +24,8 @@ namespace SnpeUtil
     std::unique_ptr<zdl::DlContainer::IDlContainer> loadContainerFromBuffer(const uint8_t *buffer, const size_t size);
 
     typedef unsigned int GLuint;
+    /// @brief ネットワークの入力サイズの ITensor を確保する。前処理の結果を直接書き込み、推論ごとに使い回す。
+    std::unique_ptr<zdl::DlSystem::ITensor> createInputTensor(std::unique_ptr<zdl::SNPE::SNPE> &snpe);
     std::unique_ptr<zdl::DlSystem::ITensor> loadInputTensor(std::unique_ptr<zdl::SNPE::SNPE> &snpe, cv::Mat inputImage);
     std::unique_ptr<zdl::DlSystem::ITensor> loadInputTensor(std::unique_ptr<zdl::SNPE::SNPE> &snpe,
                                                             SequentialPoseKeypoints &poseKeypoints);
@@ -50,6 +50,7 @@ struct TrackedBbox
     BboxXyxy bodyBbox;
     bool isBodyDetected{false}; // トラッカーの推定値が検出結果と関連付けされているとき true
     std::vector<PosePoint> poseKeypoints;
+    bool isPoseRefreshed{false}; // poseKeypoints をこのフレームで推論したとき true。前の結果を使ったときは false
     bool isHoldingObject{false}; // 人物が物体を持っているかどうか
 
     TrackedBbox() : id(0), velocity(0, 0), bodyBbox(0.0, 0.0, 0.0, 0.0){};